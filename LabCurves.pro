@@ -33,5 +33,6 @@ CONFIG += release silent
 TEMPLATE = subdirs
 
 SUBDIRS += LabCurvesProject
+SUBDIRS += LabCurvesCliProject
 
 ###############################################################################
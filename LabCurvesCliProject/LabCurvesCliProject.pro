@@ -0,0 +1,93 @@
+######################################################################
+##
+## LabCurves
+##
+## This file is part of LabCurves.
+##
+## LabCurves is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, version 3 of the License.
+##
+## LabCurves is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY; without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with LabCurves.  If not, see <http:/www.gnu.org/licenses/>.
+##
+######################################################################
+
+######################################################################
+#
+# This is the Qt project file for labcurves-cli, the guiless job mode.
+# Don't let it overwrite by qmake -project !
+# A number of settings is tuned.
+#
+# qmake will make a platform dependent makefile of it.
+#
+######################################################################
+
+CONFIG += release silent console
+CONFIG -= app_bundle
+#CONFIG += debug
+QT -= gui
+TEMPLATE = app
+TARGET = labcurves-cli
+DEPENDPATH += .
+DESTDIR = ..
+OBJECTS_DIR = ../Objects/Cli
+MOC_DIR = ../Objects/Cli
+# Bit funky for the glib.
+QMAKE_CXXFLAGS_DEBUG += -ffast-math -O0 -g
+QMAKE_CXXFLAGS_RELEASE += -O3 -fopenmp
+QMAKE_CXXFLAGS_RELEASE += -ffast-math
+QMAKE_CFLAGS_DEBUG += -ffast-math -O0 -g
+QMAKE_CFLAGS_RELEASE += -O3 -fopenmp
+QMAKE_CFLAGS_RELEASE += -ffast-math
+QMAKE_LFLAGS_RELEASE += -fopenmp
+QMAKE_LFLAGS_DEBUG += -rdynamic
+LIBS += -lGraphicsMagick++ -lGraphicsMagickWand -lGraphicsMagick
+LIBS += -lgomp -lpthread -llcms2 -ltiff
+unix {
+  QMAKE_CC = ccache /usr/bin/gcc
+  QMAKE_CXX = ccache /usr/bin/g++
+  INCLUDEPATH += /usr/include/GraphicsMagick
+}
+win32 {
+  LIBS += -lwsock32 -lexpat -lregex -lgdi32
+  INCLUDEPATH += /mingw/include/GraphicsMagick
+}
+
+
+# Input
+# Only the pipe and the image I/O : no gui sources in here !
+HEADERS += ../Sources/dlConstants.h
+HEADERS += ../Sources/dlCurve.h
+HEADERS += ../Sources/dlDefines.h
+HEADERS += ../Sources/dlError.h
+HEADERS += ../Sources/dlImage.h
+HEADERS += ../Sources/dlLut.h
+HEADERS += ../Sources/dlResize.h
+HEADERS += ../Sources/dlProcessor.h
+HEADERS += ../Sources/dlBatch.h
+HEADERS += ../Sources/dlExport.h
+HEADERS += ../Sources/dlTransformCache.h
+HEADERS += ../Sources/dlRGBLab.h
+HEADERS += ../Sources/dlCalloc.h
+SOURCES += ../Sources/dlCurve.cpp
+SOURCES += ../Sources/dlError.cpp
+SOURCES += ../Sources/dlImage.cpp
+SOURCES += ../Sources/dlLut.cpp
+SOURCES += ../Sources/dlResize.cpp
+SOURCES += ../Sources/dlImage_GM.cpp
+SOURCES += ../Sources/dlImage_GMC.cpp
+SOURCES += ../Sources/dlCliMain.cpp
+SOURCES += ../Sources/dlProcessor.cpp
+SOURCES += ../Sources/dlBatch.cpp
+SOURCES += ../Sources/dlExport.cpp
+SOURCES += ../Sources/dlTransformCache.cpp
+SOURCES += ../Sources/dlRGBLab.cpp
+SOURCES += ../Sources/dlCalloc.cpp
+
+###############################################################################
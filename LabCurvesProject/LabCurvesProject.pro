@@ -48,7 +48,7 @@ QMAKE_CFLAGS_RELEASE += -ffast-math
 QMAKE_LFLAGS_RELEASE += -fopenmp
 QMAKE_LFLAGS_DEBUG += -rdynamic
 LIBS += -lGraphicsMagick++ -lGraphicsMagickWand -lGraphicsMagick
-LIBS += -lgomp -lpthread -llcms2
+LIBS += -lgomp -lpthread -llcms2 -ltiff
 unix {
   QMAKE_CC = ccache /usr/bin/gcc
   QMAKE_CXX = ccache /usr/bin/g++
@@ -70,12 +70,18 @@ HEADERS += ../Sources/dlSettings.h
 HEADERS += ../Sources/dlGuiItems.i
 HEADERS += ../Sources/dlItems.i
 HEADERS += ../Sources/dlImage.h
+HEADERS += ../Sources/dlLut.h
 HEADERS += ../Sources/dlImage8.h
+HEADERS += ../Sources/dlResize.h
 HEADERS += ../Sources/dlMainWindow.h
 HEADERS += ../Sources/dlCurveWindow.h
 HEADERS += ../Sources/dlHistogramWindow.h
 HEADERS += ../Sources/dlViewWindow.h
 HEADERS += ../Sources/dlProcessor.h
+HEADERS += ../Sources/dlPipeWorker.h
+HEADERS += ../Sources/dlExport.h
+HEADERS += ../Sources/dlTransformCache.h
+HEADERS += ../Sources/dlRGBLab.h
 HEADERS += ../Sources/dlInput.h
 HEADERS += ../Sources/dlChoice.h
 HEADERS += ../Sources/dlCheck.h
@@ -87,7 +93,9 @@ SOURCES += ../Sources/dlError.cpp
 SOURCES += ../Sources/dlGuiOptions.cpp
 SOURCES += ../Sources/dlSettings.cpp
 SOURCES += ../Sources/dlImage.cpp
+SOURCES += ../Sources/dlLut.cpp
 SOURCES += ../Sources/dlImage8.cpp
+SOURCES += ../Sources/dlResize.cpp
 SOURCES += ../Sources/dlImage_GM.cpp
 SOURCES += ../Sources/dlImage_GMC.cpp
 SOURCES += ../Sources/dlMain.cpp
@@ -96,6 +104,10 @@ SOURCES += ../Sources/dlCurveWindow.cpp
 SOURCES += ../Sources/dlHistogramWindow.cpp
 SOURCES += ../Sources/dlViewWindow.cpp
 SOURCES += ../Sources/dlProcessor.cpp
+SOURCES += ../Sources/dlPipeWorker.cpp
+SOURCES += ../Sources/dlExport.cpp
+SOURCES += ../Sources/dlTransformCache.cpp
+SOURCES += ../Sources/dlRGBLab.cpp
 SOURCES += ../Sources/dlInput.cpp
 SOURCES += ../Sources/dlChoice.cpp
 SOURCES += ../Sources/dlCheck.cpp
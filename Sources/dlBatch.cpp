@@ -0,0 +1,349 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+#include <cstdio>
+#include <cassert>
+
+#include "dlBatch.h"
+#include "dlConstants.h"
+#include "dlError.h"
+
+#include <Magick++.h>
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+// Images up to this number of pixels are run whole image per core.
+const int dlBatch_SmallImagePixels = 4000000;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlBatchQueue
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlBatchQueue::dlBatchQueue(const int Capacity) {
+  m_Capacity = Capacity;
+  m_Closed   = 0;
+}
+
+void dlBatchQueue::Push(dlBatchJob* Job) {
+  QMutexLocker Locker(&m_Mutex);
+  while (m_Jobs.size() >= m_Capacity) m_NotFull.wait(&m_Mutex);
+  m_Jobs.enqueue(Job);
+  m_NotEmpty.wakeOne();
+}
+
+dlBatchJob* dlBatchQueue::Pop() {
+  QMutexLocker Locker(&m_Mutex);
+  while (m_Jobs.isEmpty() && !m_Closed) m_NotEmpty.wait(&m_Mutex);
+  if (m_Jobs.isEmpty()) return NULL;
+  dlBatchJob* Job = m_Jobs.dequeue();
+  m_NotFull.wakeOne();
+  return Job;
+}
+
+void dlBatchQueue::Close() {
+  QMutexLocker Locker(&m_Mutex);
+  m_Closed = 1;
+  m_NotEmpty.wakeAll();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlBatchThread
+// A thread running one stage (or all stages) of the batch.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+class dlBatchThread : public QThread {
+public:
+dlBatchThread(dlBatch* Batch, const short Stage) {
+  m_Batch = Batch;
+  m_Stage = Stage;
+}
+protected:
+void run() {
+  m_Batch->RunStage(m_Stage);
+}
+private:
+dlBatch* m_Batch;
+short    m_Stage;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Constructor
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlBatch::dlBatch(dlProcessor* Processor) {
+  m_Processor = Processor;
+  m_ToDecode  = NULL;
+  m_ToProcess = NULL;
+  m_ToEncode  = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Run
+// Pings every input to sort it into the large or the small ones,
+// then runs the large ones pipelined and the small ones per core.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int dlBatch::Run(const QStringList InputFileNames,
+                 const QString     OutputDirectory) {
+
+  QTime Timer;
+  Timer.start();
+
+  m_Failed = 0;
+
+  QList <dlBatchJob*> LargeJobs;
+  QList <dlBatchJob*> SmallJobs;
+
+  // Input file name to the input written under it, and where they go.
+  QMap <QString,QString> Outputs;
+  const QString OutputPath = QDir(OutputDirectory).canonicalPath();
+
+  for (int i=0; i<InputFileNames.size(); i++) {
+    // No output may overwrite an input or another output.
+    const QFileInfo Input(InputFileNames[i]);
+    if (!OutputPath.isEmpty() && Input.canonicalPath() == OutputPath) {
+      dlLogError(dlError_Argument,"Output of '%s' would overwrite it",
+                 InputFileNames[i].toAscii().data());
+      m_Failed.ref();
+      continue;
+    }
+    if (Outputs.contains(Input.fileName())) {
+      dlLogError(dlError_Argument,
+                 "Output of '%s' would overwrite that of '%s'",
+                 InputFileNames[i].toAscii().data(),
+                 Outputs.value(Input.fileName()).toAscii().data());
+      m_Failed.ref();
+      continue;
+    }
+    Outputs.insert(Input.fileName(),InputFileNames[i]);
+
+    int64_t Pixels = 0;
+    try {
+      Magick::Image image;
+      image.ping(InputFileNames[i].toAscii().data());
+      Pixels = (int64_t) image.columns()*image.rows();
+    } catch (Magick::Exception &Error) {
+      dlLogError(dlError_FileOpen,"Cannot decode '%s'",
+                 InputFileNames[i].toAscii().data());
+      m_Failed.ref();
+      continue;
+    }
+
+    dlBatchJob* Job = new dlBatchJob;
+    Job->InputFileName  = InputFileNames[i];
+    Job->OutputFileName = QDir(OutputDirectory).filePath(Input.fileName());
+    Job->Image          = NULL;
+    Job->ProfileSize    = 0;
+    Job->ProfileBuffer  = NULL;
+
+    if (Pixels > dlBatch_SmallImagePixels)
+      LargeJobs << Job;
+    else
+      SmallJobs << Job;
+  }
+
+  RunPipelined(LargeJobs);
+  TRACEMAIN("Done large images at %d ms.",Timer.elapsed());
+
+  RunPerCore(SmallJobs);
+  TRACEMAIN("Done small images at %d ms.",Timer.elapsed());
+
+  return m_Failed;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RunPipelined
+// One thread per stage, queues of one image in between.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlBatch::RunPipelined(QList <dlBatchJob*> Jobs) {
+
+  if (Jobs.isEmpty()) return;
+
+  m_ToDecode  = new dlBatchQueue(Jobs.size());
+  m_ToProcess = new dlBatchQueue(1);
+  m_ToEncode  = new dlBatchQueue(1);
+
+  for (int i=0; i<Jobs.size(); i++) m_ToDecode->Push(Jobs[i]);
+  m_ToDecode->Close();
+
+  dlBatchThread* Threads[3];
+  Threads[0] = new dlBatchThread(this,dlBatchStage_Decode);
+  Threads[1] = new dlBatchThread(this,dlBatchStage_Process);
+  Threads[2] = new dlBatchThread(this,dlBatchStage_Encode);
+  for (short i=0; i<3; i++) Threads[i]->start();
+  for (short i=0; i<3; i++) {
+    Threads[i]->wait();
+    delete Threads[i];
+  }
+
+  delete m_ToDecode;
+  delete m_ToProcess;
+  delete m_ToEncode;
+  m_ToDecode  = NULL;
+  m_ToProcess = NULL;
+  m_ToEncode  = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RunPerCore
+// One worker per core, each taking the next image through all stages.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlBatch::RunPerCore(QList <dlBatchJob*> Jobs) {
+
+  if (Jobs.isEmpty()) return;
+
+  m_ToDecode = new dlBatchQueue(Jobs.size());
+  for (int i=0; i<Jobs.size(); i++) m_ToDecode->Push(Jobs[i]);
+  m_ToDecode->Close();
+
+  int NrWorkers = MIN(MAX(QThread::idealThreadCount(),1),Jobs.size());
+  QList <dlBatchThread*> Threads;
+  for (int i=0; i<NrWorkers; i++) {
+    Threads << new dlBatchThread(this,dlBatchStage_All);
+    Threads[i]->start();
+  }
+  for (int i=0; i<NrWorkers; i++) {
+    Threads[i]->wait();
+    delete Threads[i];
+  }
+
+  delete m_ToDecode;
+  m_ToDecode = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RunStage
+// Body of the batch threads.
+// A stage closes its output queue when its input queue runs dry,
+// which in turn ends the next stage.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlBatch::RunStage(const short Stage) {
+
+  dlBatchJob* Job = NULL;
+
+  switch (Stage) {
+    case dlBatchStage_Decode :
+      while ((Job = m_ToDecode->Pop())) {
+        if (Decode(Job)) m_ToProcess->Push(Job);
+      }
+      m_ToProcess->Close();
+      break;
+
+    case dlBatchStage_Process :
+      while ((Job = m_ToProcess->Pop())) {
+        Process(Job);
+        m_ToEncode->Push(Job);
+      }
+      m_ToEncode->Close();
+      break;
+
+    case dlBatchStage_Encode :
+      while ((Job = m_ToEncode->Pop())) {
+        Encode(Job);
+      }
+      break;
+
+    case dlBatchStage_All :
+      // The parallelism is over the images, not within.
+#ifdef _OPENMP
+      omp_set_num_threads(1);
+#endif
+      while ((Job = m_ToDecode->Pop())) {
+        if (!Decode(Job)) continue;
+        Process(Job);
+        Encode(Job);
+      }
+      break;
+
+    default : // Should not happen.
+      assert(0);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// The stages. Decode returns 0 (and drops the job) on failure, Encode
+// counts a failed write.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlBatch::Decode(dlBatchJob* Job) {
+  int Success = 0;
+  Job->Image = new dlImage();
+  Job->Image->dlGMOpenImage(Job->InputFileName.toAscii().data(),
+                            Job->ProfileSize,
+                            Job->ProfileBuffer,
+                            Success,
+                            m_Processor->m_Settings.Tiled);
+  if (!Success) {
+    dlLogError(dlError_FileOpen,"Cannot decode '%s'",
+               Job->InputFileName.toAscii().data());
+    m_Failed.ref();
+    delete Job->Image;
+    FREE(Job->ProfileBuffer);
+    delete Job;
+    return 0;
+  }
+  return 1;
+}
+
+void dlBatch::Process(dlBatchJob* Job) {
+  m_Processor->RunLab(Job->Image);
+}
+
+void dlBatch::Encode(dlBatchJob* Job) {
+  const short Written =
+    Job->Image->lcmsLabToProfile(Job->ProfileBuffer,Job->ProfileSize) &&
+    Job->Image->dlGMCWriteImage(Job->OutputFileName.toAscii().data(),
+                                Job->ProfileBuffer,
+                                Job->ProfileSize);
+  if (!Written) {
+    dlLogError(dlError_FileOpen,"Cannot write '%s'",
+               Job->OutputFileName.toAscii().data());
+    m_Failed.ref();
+  }
+  delete Job->Image;
+  FREE(Job->ProfileBuffer);
+  delete Job;
+}
+
+////////////////////////////////////////////////////////////////////////////////
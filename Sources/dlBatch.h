@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DLBATCH_H
+#define DLBATCH_H
+
+#include <QtCore>
+
+#include "dlImage.h"
+#include "dlProcessor.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlBatchJob
+// One image on its way through the batch.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct dlBatchJob {
+QString  InputFileName;
+QString  OutputFileName;
+dlImage* Image;
+long     ProfileSize;
+uint8_t* ProfileBuffer;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlBatchQueue
+// Bounded, blocking queue of jobs between two stages.
+// Pop returns NULL once the queue is closed and empty.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+class dlBatchQueue {
+public:
+
+dlBatchQueue(const int Capacity);
+
+void        Push(dlBatchJob* Job);
+dlBatchJob* Pop();
+// No more pushes. Wakes up all waiting consumers.
+void        Close();
+
+private:
+QQueue <dlBatchJob*> m_Jobs;
+int                  m_Capacity;
+short                m_Closed;
+QMutex               m_Mutex;
+QWaitCondition       m_NotEmpty;
+QWaitCondition       m_NotFull;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlBatch
+// Runs the job mode pipe over a list of files.
+//
+// Large images go through three stages, each in its own thread with
+// OpenMP inside the stage :
+//   decode  (dlGMOpenImage)
+//   process (dlProcessor::RunLab)
+//   encode  (lcmsLabToProfile and dlGMCWriteImage)
+// The stages are connected by queues of one image, so decoding image
+// N+1 overlaps processing N and encoding N-1, with at most five
+// images in memory.
+//
+// Small images are not worth the OpenMP overhead. Those are run whole
+// image per core : one worker per core, each doing all three stages
+// single threaded.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+class dlBatch {
+public:
+
+// Constructor
+dlBatch(dlProcessor* Processor);
+
+// Run the batch. Output files go to OutputDirectory with the input
+// file name. Inputs whose output would overwrite an input (they are in
+// OutputDirectory) or the output of an earlier one (same file name)
+// are not run and count as failed. Returns the number of failed images.
+int Run(const QStringList InputFileNames,
+        const QString     OutputDirectory);
+
+// Entry point for the stage threads.
+void RunStage(const short Stage);
+
+private:
+void RunPipelined(QList <dlBatchJob*> Jobs);
+void RunPerCore(QList <dlBatchJob*> Jobs);
+
+short Decode(dlBatchJob* Job);
+void  Process(dlBatchJob* Job);
+void  Encode(dlBatchJob* Job);
+
+dlProcessor*  m_Processor;
+dlBatchQueue* m_ToDecode;
+dlBatchQueue* m_ToProcess;
+dlBatchQueue* m_ToEncode;
+QAtomicInt    m_Failed;
+};
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
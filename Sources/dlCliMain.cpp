@@ -0,0 +1,208 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <QtCore>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "dlProcessor.h"
+#include "dlBatch.h"
+#include "dlExport.h"
+#include "dlTransformCache.h"
+#include "dlCurve.h"
+#include "dlError.h"
+
+#include <Magick++.h>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Entry point of labcurves-cli, the guiless job mode.
+// Only the pipe (dlProcessor on dlImage and dlCurve) and the
+// GraphicsMagick/lcms I/O are involved : no QApplication, no windows,
+// so it runs on hosts without X server.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlProcessor* TheProcessor = NULL;
+
+// L,a,b,saturation
+dlCurve*  Curve[4]        = {NULL,NULL,NULL,NULL};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Progress function. Plain stdout in job mode.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void ReportProgress(const QString Message) {
+  printf("Progress : %s\n",Message.toAscii().data());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Usage
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void Usage() {
+  fprintf(stderr,
+    "Usage : labcurves-cli [options] Input Output\n"
+    "        labcurves-cli [options] -o OutputDirectory Input ...\n"
+    "  -L Curve.dlc   L curve\n"
+    "  -a Curve.dlc   a curve\n"
+    "  -b Curve.dlc   b curve\n"
+    "  -s Curve.dlc   saturation curve\n"
+    "  -m Mode        saturation mode (0 absolute, 1 adaptive)\n"
+    "  -t Type        saturation type (0 by hue, 1 by luminance)\n"
+    "  -T Tiled       tiled storage, for very large images (0 off, 1 on)\n"
+    "                 only with -o, a single image is exported in strips\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RunJob
+// Run Input through the full size pipe, in strips (dlExport), and
+// write Output in the embedded (or sRGB) profile. Returns 0 on success.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short RunJob(const QString InputFileName,
+             const QString OutputFileName) {
+
+  TheProcessor->m_Settings.InputFileName = InputFileName;
+
+  dlExport Export(TheProcessor);
+  short Error = Export.Run(InputFileName,OutputFileName);
+  if (Error) return Error;
+
+  ReportProgress(QObject::tr("Ready"));
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Main
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int Argc, char *Argv[]) {
+  Magick::InitializeMagick(*Argv);
+
+  // TextCodec, as in the gui.
+  QTextCodec::setCodecForCStrings(QTextCodec::codecForLocale());
+
+  const char* CurveFileName[4] = {NULL,NULL,NULL,NULL};
+  const char* OutputDirectory  = NULL;
+  short SatCurveMode = 0;
+  short SatCurveType = 0;
+  short Tiled        = 0;
+  QStringList FileNames;
+
+  for (int i=1; i<Argc; i++) {
+    if (Argv[i][0] == '-' && Argv[i][1] && !Argv[i][2]) {
+      if (i+1 >= Argc) {
+        Usage();
+        return EXIT_FAILURE;
+      }
+      switch (Argv[i][1]) {
+        case 'L' : CurveFileName[dlCurveChannel_L] = Argv[++i]; break;
+        case 'a' : CurveFileName[dlCurveChannel_a] = Argv[++i]; break;
+        case 'b' : CurveFileName[dlCurveChannel_b] = Argv[++i]; break;
+        case 's' :
+          CurveFileName[dlCurveChannel_Saturation] = Argv[++i]; break;
+        case 'm' : SatCurveMode = atoi(Argv[++i]) ? 1 : 0; break;
+        case 't' : SatCurveType = atoi(Argv[++i]) ? 1 : 0; break;
+        case 'T' : Tiled        = atoi(Argv[++i]) ? 1 : 0; break;
+        case 'o' : OutputDirectory = Argv[++i]; break;
+        default :
+          Usage();
+          return EXIT_FAILURE;
+      }
+    } else {
+      FileNames << Argv[i];
+    }
+  }
+
+  if ((!OutputDirectory && FileNames.size() != 2) ||
+      ( OutputDirectory && FileNames.size() == 0)) {
+    Usage();
+    return EXIT_FAILURE;
+  }
+
+  // A single image goes through dlExport in strips, tiles are not used.
+  if (Tiled && !OutputDirectory) {
+    fprintf(stderr,"-T needs -o\n");
+    Usage();
+    return EXIT_FAILURE;
+  }
+
+  // Transforms built by earlier runs.
+  dlTransformCache::SetDirectory(dlTransformCache::DefaultDirectory());
+
+  TheProcessor = new dlProcessor(ReportProgress);
+  dlProcessorSettings* PipeSettings = &TheProcessor->m_Settings;
+
+  // Curves. Any curve not given stays a null curve and is not applied.
+  short* CurveSetting[4] = {&PipeSettings->CurveL,
+                            &PipeSettings->CurveLa,
+                            &PipeSettings->CurveLb,
+                            &PipeSettings->CurveSaturation};
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    Curve[Channel] = new dlCurve(Channel);
+    if (!CurveFileName[Channel]) continue;
+    if (Curve[Channel]->ReadCurve(CurveFileName[Channel])) {
+      dlLogError(dlError_FileOpen,"Cannot read curve '%s'",
+                 CurveFileName[Channel]);
+      return EXIT_FAILURE;
+    }
+    *CurveSetting[Channel] = dlCurveChoice_File;
+  }
+
+  // Full size, no cached intermediates.
+  PipeSettings->JobMode      = 1;
+  PipeSettings->PipeSize     = dlPipeSize_Full;
+  PipeSettings->SatCurveMode = SatCurveMode;
+  PipeSettings->SatCurveType = SatCurveType;
+  PipeSettings->Tiled        = Tiled;
+
+  short Error = 0;
+  if (OutputDirectory) {
+    dlBatch Batch(TheProcessor);
+    int NrFailed = Batch.Run(FileNames,OutputDirectory);
+    if (NrFailed) {
+      fprintf(stderr,"%d of %d images failed\n",NrFailed,FileNames.size());
+      Error = dlError_FileOpen;
+    }
+  } else {
+    Error = RunJob(FileNames[0],FileNames[1]);
+  }
+
+  delete TheProcessor;
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    delete Curve[Channel];
+  }
+
+  return Error ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -56,6 +56,15 @@ const short dlProcessorPhase_Output      = 3;
 const short dlProcessorMode_Preview     = 0;
 const short dlProcessorMode_Full        = 1;
 const short dlProcessorMode_Thumb       = 2;
+// On the coarse level, while a curve is dragged.
+const short dlProcessorMode_Drag        = 3;
+
+// Batch stages.
+
+const short dlBatchStage_Decode         = 0;
+const short dlBatchStage_Process        = 1;
+const short dlBatchStage_Encode         = 2;
+const short dlBatchStage_All            = 3;
 
 // Color spaces.
 
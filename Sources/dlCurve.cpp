@@ -21,7 +21,6 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-#include <QMessageBox>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -66,11 +65,11 @@ short dlCurve::SetNullCurve(const short Channel) {
     m_Type            = dlCurveType_Anchor;
     m_NrAnchors       = 3;
     m_XAnchor[0]      = 0.0;
-    m_YAnchor[0]      = 0.5;
+    m_YAnchor[0]      = 0x7fff/(double)0xffff; // Factor 1 in dlSaturate
     m_XAnchor[1]      = 0.5;
-    m_YAnchor[1]      = 0.5;
+    m_YAnchor[1]      = 0x7fff/(double)0xffff;
     m_XAnchor[2]      = 1.0;
-    m_YAnchor[2]      = 0.5;
+    m_YAnchor[2]      = 0x7fff/(double)0xffff;
   } else if (Channel == dlCurveChannel_a || Channel == dlCurveChannel_b) {
     m_Type            = dlCurveType_Anchor;
     m_NrAnchors       = 3;
@@ -93,6 +92,23 @@ short dlCurve::SetNullCurve(const short Channel) {
   return SetCurveFromAnchors();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// IsNull
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlCurve::IsNull(const short Channel) const {
+  if (Channel == dlCurveChannel_Saturation) {
+    for (uint32_t i=0; i<0x10000; i++)
+      if (m_Curve[i] != 0x7fff) return 0;
+  } else {
+    for (uint32_t i=0; i<0x10000; i++)
+      if (m_Curve[i] != i) return 0;
+  }
+  return 1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // SetCurveFromAnchors
@@ -112,6 +112,10 @@ short SetCurveFromAnchors();
 // Sets a straight line with Anchors.
 short SetNullCurve(const short Channel = 0);
 
+// Returns 1 if applying the curve as Channel changes no pixel :
+// identity table for L,a,b, a factor of exactly 1 for saturation.
+short IsNull(const short Channel) const;
+
 // Sets a curve from a mathematical function over the (0,0)..(1,1) box.
 //   The function is passed as parameter Function who's first argument
 //     will be the x (0..1) of the function.
@@ -30,6 +30,7 @@ using namespace std;
 
 void CB_CurveWindowManuallyChanged(const short Channel);
 void CB_CurveWindowRecalc(const short Channel);
+void CB_CurveWindowDragged(const short Channel);
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -81,6 +82,15 @@ dlCurveWindow::dlCurveWindow(dlCurve*    RelatedCurve,
           this,
           SLOT(ResizeTimerExpired()));
 
+  // While dragging the preview comes from the coarse level, when the
+  // mouse rests this long the pipe size follows.
+  m_DragTimer = new QTimer(this);
+  m_DragTimer->setSingleShot(1);
+  connect(m_DragTimer,
+          SIGNAL(timeout()),
+          this,
+          SLOT(DragTimerExpired()));
+
   m_AtnAdaptive = new QAction(QObject::tr("Adaptive"), this);
   m_AtnAdaptive->setStatusTip(QObject::tr("Adaptive saturation"));
   m_AtnAdaptive->setCheckable(true);
@@ -653,10 +663,28 @@ void dlCurveWindow::mouseMoveEvent(QMouseEvent *Event) {
     m_OverlayAnchorX = (int32_t) (X*(Width-1));
     m_OverlayAnchorY = (int32_t) ((1.0 - Y) * (Height-1));
     UpdateView();
+
+    // Quick preview now, the full one when the mouse rests.
+    m_RecalcNeeded = 1;
+    CB_CurveWindowDragged(m_Channel);
+    m_DragTimer->start(300); // 300 ms.
   }
   return;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// DragTimerExpired
+// The drag paused : the preview at the pipe size.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlCurveWindow::DragTimerExpired() {
+  if (m_MovingAnchor == -1 || !m_RecalcNeeded) return;
+  CB_CurveWindowRecalc(m_Channel);
+  m_RecalcNeeded = 0;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // mouseReleaseEvent handler.
@@ -669,6 +697,7 @@ void dlCurveWindow::mouseReleaseEvent(QMouseEvent*) {
   if (m_BlockEvents) return;
 
   m_MovingAnchor = -1;
+  m_DragTimer->stop();
   // This recalculates the image at release of the button.
   // As this takes time we block further events on this one
   // at least.
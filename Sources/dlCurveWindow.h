@@ -45,6 +45,7 @@ public :
 QWidget*       m_Parent;
 dlCurve*       m_RelatedCurve;
 QTimer*        m_ResizeTimer; // To circumvent multi resize events.
+QTimer*        m_DragTimer;   // Full preview once a drag pauses.
 short          m_Channel;
 dlImage8*      m_Image8;
 
@@ -75,6 +76,7 @@ int  heightForWidth(int w) const { return w;};
 
 private slots:
 void ResizeTimerExpired();
+void DragTimerExpired();
 void SetSatMode();
 void SetSatType();
 void SetInterpolationType();
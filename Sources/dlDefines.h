@@ -58,6 +58,10 @@
 // Uncomment me for malloc/calloc/free related leaks.
 // #define DEBUG_MEMORY
 
+// Uncomment me to check the saturation tables against dlSaturate
+// after each rebuild.
+// #define DEBUG_SATURATIONLUT
+
 #ifdef DEBUG_MEMORY
 
   #include "dlCalloc.h"
@@ -0,0 +1,443 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+#include <cstring>
+
+#include "dlExport.h"
+#include "dlImage.h"
+#include "dlConstants.h"
+#include "dlError.h"
+#include "dlTransformCache.h"
+#include "dlCurve.h"
+#include "dlRGBLab.h"
+
+#include <Magick++.h>
+#include <tiffio.h>
+
+using namespace Magick;
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+#include <lcms2.h>
+
+// Pixels per strip, 24 MB in Lab.
+const uint32_t dlExport_StripPixels = 4000000;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// TransformStrip, in place and in parallel chunks.
+// With Analytic given that converts (ToLab or back) instead of lcms.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void TransformStrip(cmsHTRANSFORM   Transform,
+                           const dlRGBLab* Analytic,
+                           const short     ToLab,
+                           uint16_t        (*Pixels)[3],
+                           const int64_t   Size) {
+  if (!Analytic) {
+    dlTransformCache::Run(Transform,Pixels,Pixels,Size);
+    return;
+  }
+  int32_t Step = dlTransformCache::ChunkPixels(Size);
+#pragma omp parallel for schedule(dynamic)
+  for (int64_t i = 0; i < Size; i+=Step) {
+    int32_t Length = (i+Step)<Size ? Step : Size - i;
+    if (ToLab) {
+      Analytic->ToLab(Pixels+i,Length);
+    } else {
+      Analytic->FromLab(Pixels+i,Length);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// IsStripTiff
+// A TIFF libtiff can read per scanline into RGB as it is. By the magic
+// number first, so libtiff does not complain about other files.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static short IsStripTiff(const QString FileName) {
+  QFile File(FileName);
+  if (!File.open(QIODevice::ReadOnly)) return 0;
+  const QByteArray Magic = File.read(4);
+  File.close();
+  if (Magic != QByteArray("II*\0",4) &&
+      Magic != QByteArray("MM\0*",4)) return 0;
+
+  TIFF* Tiff = TIFFOpen(FileName.toAscii().data(),"r");
+  if (!Tiff) return 0;
+  uint16_t Photometric = 0;
+  uint16_t Samples     = 0;
+  uint16_t Bits        = 0;
+  uint16_t Planar      = 0;
+  uint16_t Format      = 0;
+  uint16_t Orientation = 0;
+  TIFFGetFieldDefaulted(Tiff,TIFFTAG_SAMPLESPERPIXEL,&Samples);
+  TIFFGetFieldDefaulted(Tiff,TIFFTAG_BITSPERSAMPLE,&Bits);
+  TIFFGetFieldDefaulted(Tiff,TIFFTAG_PLANARCONFIG,&Planar);
+  TIFFGetFieldDefaulted(Tiff,TIFFTAG_SAMPLEFORMAT,&Format);
+  TIFFGetFieldDefaulted(Tiff,TIFFTAG_ORIENTATION,&Orientation);
+  const short Result =
+    !TIFFIsTiled(Tiff) &&
+    TIFFGetField(Tiff,TIFFTAG_PHOTOMETRIC,&Photometric) &&
+    Photometric == PHOTOMETRIC_RGB &&
+    Samples     == 3 &&
+    (Bits == 8 || Bits == 16) &&
+    Planar      == PLANARCONFIG_CONTIG &&
+    Format      == SAMPLEFORMAT_UINT &&
+    Orientation == ORIENTATION_TOPLEFT;
+  TIFFClose(Tiff);
+  return Result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Constructor
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlExport::dlExport(dlProcessor* Processor) {
+  m_Processor     = Processor;
+  m_SaturationLut = NULL;
+  m_ApplyCurves   = 0;
+  m_ToLab         = NULL;
+  m_FromLab       = NULL;
+  m_Analytic      = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Run
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlExport::Run(const QString InputFileName,
+                    const QString OutputFileName) {
+  const QString Suffix = QFileInfo(OutputFileName).suffix().toLower();
+  if ((Suffix == "tif" || Suffix == "tiff") && IsStripTiff(InputFileName)) {
+    return RunTiff(InputFileName,OutputFileName);
+  }
+  return RunMagick(InputFileName,OutputFileName);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Prepare
+// Nothing to apply : the pixels are encoded as decoded.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlExport::Prepare(const uint8_t* ProfileBuffer,
+                        const long     ProfileSize) {
+  m_ApplyCurves = m_Processor->SelectLabCurves(m_LabCurve,m_SaturationLut);
+  m_ToLab    = NULL;
+  m_FromLab  = NULL;
+  m_Analytic = NULL;
+  if (!m_ApplyCurves) return 0;
+
+  // The output is in the embedded profile, sRGB if there is none.
+  m_ToLab = dlTransformCache::Get(ProfileBuffer,ProfileSize,TYPE_RGB_16,
+                                  NULL,0,TYPE_Lab_16,
+                                  INTENT_PERCEPTUAL,
+                                  cmsFLAGS_BLACKPOINTCOMPENSATION);
+  m_FromLab = dlTransformCache::Get(NULL,0,TYPE_Lab_16,
+                                    ProfileBuffer,ProfileSize,TYPE_RGB_16,
+                                    INTENT_PERCEPTUAL,
+                                    cmsFLAGS_BLACKPOINTCOMPENSATION);
+  if (!m_ToLab || !m_FromLab) return dlError_lcms;
+  // Computed instead if the profile is one of the built in spaces.
+  m_Analytic = dlRGBLab::Get(ProfileBuffer,ProfileSize);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Convert
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlExport::Convert(dlImage* Strip) {
+  if (!m_ApplyCurves) return;
+  const int64_t Size = (int64_t)Strip->m_Width*Strip->m_Height;
+  Strip->m_ColorSpace = dlSpace_Lab;
+  TransformStrip(m_ToLab,m_Analytic,1,Strip->m_Image,Size);
+  Strip->ApplyLabCurves(m_LabCurve[dlCurveChannel_L],
+                        m_LabCurve[dlCurveChannel_a],
+                        m_LabCurve[dlCurveChannel_b],
+                        m_SaturationLut);
+  TransformStrip(m_FromLab,m_Analytic,0,Strip->m_Image,Size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RunTiff
+// Each strip is read, converted and written before the next is read.
+// The output is LZW compressed like the one of GraphicsMagick, with
+// the profile and the resolution of the input.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlExport::RunTiff(const QString InputFileName,
+                        const QString OutputFileName) {
+
+  QTime Timer;
+  Timer.start();
+
+  TIFF* Input = TIFFOpen(InputFileName.toAscii().data(),"r");
+  if (!Input) {
+    dlLogError(dlError_FileOpen,"Cannot decode '%s'",
+               InputFileName.toAscii().data());
+    return dlError_FileOpen;
+  }
+
+  uint32_t Width  = 0;
+  uint32_t Height = 0;
+  uint16_t Depth  = 8;
+  TIFFGetField(Input,TIFFTAG_IMAGEWIDTH,&Width);
+  TIFFGetField(Input,TIFFTAG_IMAGELENGTH,&Height);
+  TIFFGetFieldDefaulted(Input,TIFFTAG_BITSPERSAMPLE,&Depth);
+
+  uint32_t ProfileSize   = 0;
+  void*    ProfileBuffer = NULL;
+  TIFFGetField(Input,TIFFTAG_ICCPROFILE,&ProfileSize,&ProfileBuffer);
+
+  short Error = Prepare((const uint8_t*) ProfileBuffer,ProfileSize);
+  if (Error) {
+    TIFFClose(Input);
+    return Error;
+  }
+
+  TIFF* Output = TIFFOpen(OutputFileName.toAscii().data(),"w");
+  if (!Output) {
+    TIFFClose(Input);
+    dlLogError(dlError_FileOpen,"Cannot write '%s'",
+               OutputFileName.toAscii().data());
+    return dlError_FileOpen;
+  }
+  TIFFSetField(Output,TIFFTAG_IMAGEWIDTH,Width);
+  TIFFSetField(Output,TIFFTAG_IMAGELENGTH,Height);
+  TIFFSetField(Output,TIFFTAG_BITSPERSAMPLE,Depth);
+  TIFFSetField(Output,TIFFTAG_SAMPLESPERPIXEL,3);
+  TIFFSetField(Output,TIFFTAG_PHOTOMETRIC,PHOTOMETRIC_RGB);
+  TIFFSetField(Output,TIFFTAG_PLANARCONFIG,PLANARCONFIG_CONTIG);
+  TIFFSetField(Output,TIFFTAG_ORIENTATION,ORIENTATION_TOPLEFT);
+  TIFFSetField(Output,TIFFTAG_COMPRESSION,COMPRESSION_LZW);
+  TIFFSetField(Output,TIFFTAG_ROWSPERSTRIP,TIFFDefaultStripSize(Output,0));
+  if (ProfileSize) {
+    TIFFSetField(Output,TIFFTAG_ICCPROFILE,ProfileSize,ProfileBuffer);
+  }
+  float    Resolution;
+  uint16_t Unit;
+  if (TIFFGetField(Input,TIFFTAG_XRESOLUTION,&Resolution)) {
+    TIFFSetField(Output,TIFFTAG_XRESOLUTION,Resolution);
+  }
+  if (TIFFGetField(Input,TIFFTAG_YRESOLUTION,&Resolution)) {
+    TIFFSetField(Output,TIFFTAG_YRESOLUTION,Resolution);
+  }
+  if (TIFFGetField(Input,TIFFTAG_RESOLUTIONUNIT,&Unit)) {
+    TIFFSetField(Output,TIFFTAG_RESOLUTIONUNIT,Unit);
+  }
+
+  // One strip, reused. The last one may have less rows.
+  const uint32_t StripHeight =
+    MAX(1,MIN(Height,dlExport_StripPixels/MAX(Width,1)));
+  dlImage Strip;
+  Strip.m_Width  = Width;
+  Strip.m_Colors = 3;
+  Strip.m_Depth  = Depth;
+  Strip.m_Image  = (uint16_t (*)[3])
+    CALLOC((size_t)Width*StripHeight,sizeof(*Strip.m_Image));
+  dlMemoryError(Strip.m_Image,__FILE__,__LINE__);
+  // 16 bit scanlines are read and written in the strip itself.
+  uint8_t* Line = NULL;
+  if (Depth == 8) {
+    Line = (uint8_t*) CALLOC((size_t)Width,3);
+    dlMemoryError(Line,__FILE__,__LINE__);
+  }
+
+  m_Processor->m_ReportProgress(QObject::tr("Exporting"));
+
+  for (uint32_t Top = 0; !Error && Top < Height; Top += StripHeight) {
+    const uint32_t Rows = MIN(StripHeight,Height-Top);
+    Strip.m_Height = Rows;
+
+    for (uint32_t Row = 0; Row < Rows; Row++) {
+      uint16_t (*Pixels)[3] = Strip.m_Image + (int64_t)Row*Width;
+      if (TIFFReadScanline(Input,Line ? (void*) Line : (void*) Pixels,
+                           Top+Row,0) < 0) {
+        dlLogError(dlError_FileOpen,"Cannot decode '%s'",
+                   InputFileName.toAscii().data());
+        Error = dlError_FileOpen;
+        break;
+      }
+      if (Line) {
+        for (uint32_t i = 0; i < Width; i++) {
+          for (short c = 0; c < 3; c++) Pixels[i][c] = Line[3*i+c]*0x101;
+        }
+      }
+    }
+    if (Error) break;
+
+    Convert(&Strip);
+
+    for (uint32_t Row = 0; Row < Rows; Row++) {
+      uint16_t (*Pixels)[3] = Strip.m_Image + (int64_t)Row*Width;
+      if (Line) {
+        for (uint32_t i = 0; i < Width; i++) {
+          for (short c = 0; c < 3; c++) {
+            Line[3*i+c] = (Pixels[i][c]+128)/0x101;
+          }
+        }
+      }
+      if (TIFFWriteScanline(Output,Line ? (void*) Line : (void*) Pixels,
+                            Top+Row,0) < 0) {
+        dlLogError(dlError_FileOpen,"Cannot write '%s'",
+                   OutputFileName.toAscii().data());
+        Error = dlError_FileOpen;
+        break;
+      }
+    }
+  }
+
+  if (!Error && !TIFFFlush(Output)) {
+    dlLogError(dlError_FileOpen,"Cannot write '%s'",
+               OutputFileName.toAscii().data());
+    Error = dlError_FileOpen;
+  }
+  TIFFClose(Output);
+  TIFFClose(Input);
+  if (Line) FREE(Line);
+
+  // No half written output.
+  if (Error) QFile::remove(OutputFileName);
+
+  TRACEMAIN("Exported in strips at %d ms.",Timer.elapsed());
+
+  return Error;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RunMagick
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlExport::RunMagick(const QString InputFileName,
+                          const QString OutputFileName) {
+
+  QTime Timer;
+  Timer.start();
+
+  Magick::Image image;
+  try {
+    image.read(InputFileName.toAscii().data());
+  } catch (Exception &Error) {
+    dlLogError(dlError_FileOpen,"Cannot decode '%s'",
+               InputFileName.toAscii().data());
+    return dlError_FileOpen;
+  }
+  TRACEMAIN("Decoded at %d ms.",Timer.elapsed());
+
+  const short Depth = (image.depth() == 16) ? 16 : 8;
+
+  // The strips are put back as RGB.
+  image.type(TrueColorType);
+  image.modifyImage();
+
+  const uint32_t Width  = image.columns();
+  const uint32_t Height = image.rows();
+
+  Magick::Blob Profile = image.iccColorProfile();
+
+  const short Prepared = Prepare((const uint8_t*) Profile.data(),
+                                 Profile.length());
+  if (Prepared) return Prepared;
+
+  // One strip, reused. The last one may have less rows.
+  const uint32_t StripHeight =
+    MAX(1,MIN(Height,dlExport_StripPixels/MAX(Width,1)));
+  dlImage Strip;
+  Strip.m_Width  = Width;
+  Strip.m_Colors = 3;
+  Strip.m_Depth  = Depth;
+  if (m_ApplyCurves) {
+    Strip.m_Image = (uint16_t (*)[3])
+      CALLOC((size_t)Width*StripHeight,sizeof(*Strip.m_Image));
+    dlMemoryError(Strip.m_Image,__FILE__,__LINE__);
+  }
+
+  m_Processor->m_ReportProgress(QObject::tr("Exporting"));
+
+  short Failed = 0;
+  for (uint32_t Top = 0; m_ApplyCurves && Top < Height; Top += StripHeight) {
+    const uint32_t Rows = MIN(StripHeight,Height-Top);
+    const int64_t  Size = (int64_t)Width*Rows;
+    Strip.m_Height = Rows;
+
+    image.write(0,Top,Width,Rows,"RGB",ShortPixel,Strip.m_Image);
+    Convert(&Strip);
+
+    PixelPacket* Pixels = image.getPixels(0,Top,Width,Rows);
+    if (!Pixels) {
+      Failed = 1;
+      break;
+    }
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < Size; i++) {
+      Pixels[i].red   = ScaleShortToQuantum(Strip.m_Image[i][0]);
+      Pixels[i].green = ScaleShortToQuantum(Strip.m_Image[i][1]);
+      Pixels[i].blue  = ScaleShortToQuantum(Strip.m_Image[i][2]);
+    }
+    image.syncPixels();
+  }
+  TRACEMAIN("Converted at %d ms.",Timer.elapsed());
+
+  if (Failed) {
+    dlLogError(dlError_NotForeseen,"Cannot access the pixels of '%s'",
+               InputFileName.toAscii().data());
+    return dlError_NotForeseen;
+  }
+
+  m_Processor->m_ReportProgress(QObject::tr("Writing output"));
+
+  try {
+    image.renderingIntent(PerceptualIntent);
+    image.depth(Depth);
+    image.compressType(LZWCompression);
+    image.write(OutputFileName.toAscii().data());
+  } catch (Exception &Error) {
+    dlLogError(dlError_FileOpen,"Cannot write '%s'",
+               OutputFileName.toAscii().data());
+    return dlError_FileOpen;
+  }
+  TRACEMAIN("Written at %d ms.",Timer.elapsed());
+
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,90 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DLEXPORT_H
+#define DLEXPORT_H
+
+#include <QtCore>
+
+#include <lcms2.h>
+
+#include "dlProcessor.h"
+#include "dlRGBLab.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlExport
+// Full size export in horizontal strips.
+//
+// Per strip the pixels are converted to Lab, run through the Lab curves
+// of the processor and converted back to the profile of the input.
+// The conversions are the ones of the batch path (computed for the
+// built in spaces), so the output does not depend on the way it is
+// made. Without any curve to apply the pixels are not converted.
+//
+// TIFF to TIFF (RGB in strips, 8 or 16 bit, as the GIMP plugin writes)
+// is decoded and encoded with libtiff a strip at a time, so only one
+// strip and the buffers of libtiff are in memory, whatever the size of
+// the image.
+//
+// Other files go through GraphicsMagick, which has no encoder working
+// per strip : the whole image is decoded in its pixel cache (8 bytes
+// per pixel, to disk once beyond its resource limits), the strips are
+// put back in it and it is encoded at the end. That still saves the
+// float buffer, the Lab image and the copy made for the encoder.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+class dlExport {
+public:
+
+// Constructor
+dlExport(dlProcessor* Processor);
+
+// Export InputFileName to OutputFileName. Returns 0 on success.
+short Run(const QString InputFileName,
+          const QString OutputFileName);
+
+private:
+// The transforms and curves for the profile of the input.
+short Prepare(const uint8_t* ProfileBuffer,
+              const long     ProfileSize);
+// From and to RGB in place, Strip holds m_Width*m_Height pixels.
+void  Convert(dlImage* Strip);
+
+short RunTiff(const QString InputFileName,
+              const QString OutputFileName);
+short RunMagick(const QString InputFileName,
+                const QString OutputFileName);
+
+dlProcessor*           m_Processor;
+const dlCurve*         m_LabCurve[4];
+const dlSaturationLut* m_SaturationLut;
+short                  m_ApplyCurves;
+cmsHTRANSFORM          m_ToLab;
+cmsHTRANSFORM          m_FromLab;
+const dlRGBLab*        m_Analytic;
+};
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
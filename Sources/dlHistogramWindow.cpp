@@ -30,8 +30,6 @@
   #include <omp.h>
 #endif
 
-extern float ToFloatTable[0x10000];
-
 using namespace std;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -43,7 +41,7 @@ using namespace std;
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-dlHistogramWindow::dlHistogramWindow(const dlImage* RelatedImage,
+dlHistogramWindow::dlHistogramWindow(const QImage*  RelatedImage,
                                            QWidget* Parent)
   :QWidget(NULL) {
 
@@ -166,7 +164,7 @@ void dlHistogramWindow::ResizeTimerExpired() {
   // Create side effect for recalibrating the maximum
   m_PreviousHistogramGamma = -1;
   // m_RelatedImage enforces update, even if it is the same image.
-  UpdateView(m_RelatedImage);
+  UpdateView(m_RelatedImage,m_Crop);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -192,48 +190,71 @@ void dlHistogramWindow::CalculateHistogram() {
   // Zero the Histogram
   memset(Histogram,0,sizeof(Histogram));
 
-  // MaxColor (We want only the luminance in LAB).
-  short MaxColor = (m_RelatedImage->m_ColorSpace==dlSpace_Lab)?1:3;
+  // The preview is RGB.
+  const short MaxColor = 3;
+
+  const QRect Area = m_Crop.isEmpty() ?
+    m_RelatedImage->rect() : (m_Crop & m_RelatedImage->rect());
 
   // Average of ideal linear histogram.
   uint32_t HistoAverage =
-    m_RelatedImage->m_Width*m_RelatedImage->m_Height/HistogramWidth;
+    (uint64_t)Area.width()*Area.height()/HistogramWidth;
 
   //printf("(%s,%d) %d\n",__FILE__,__LINE__,Timer.elapsed());
-  // Calculate Histogram
-  const uint16_t Width  = m_RelatedImage->m_Width;
-  const uint16_t Height = m_RelatedImage->m_Height;
-  const int32_t Size   = Width*Height;
+  // Calculate Histogram : first per 8 bit level, straight from the
+  // scanlines (of the crop only).
   const short HistogramGamma = 0;
-  float r = 0;
-  uint16_t HistogramPoint = 0;
-#pragma omp parallel default(shared) private (r, HistogramPoint)
+  uint32_t Levels[3][0x100];
+  memset(Levels,0,sizeof(Levels));
+#pragma omp parallel default(shared)
     {
 #ifdef _OPENMP
       // We need a thread-private copy.
-      int TpHistogram[3][HistogramWidth];
-      memset (TpHistogram, 0, sizeof Histogram);
-#endif
-#pragma omp for
-    for (int32_t i=0; i<(int32_t) Size; i++) {
-      for (short c=0;c<MaxColor;c++) {
-        r = ToFloatTable[m_RelatedImage->m_Image[i][c]];
-        HistogramPoint = (uint16_t)(r*HistogramWidth);
-#ifdef _OPENMP
-          TpHistogram[c][HistogramPoint]++;
+      uint32_t TpLevels[3][0x100];
+      memset (TpLevels, 0, sizeof TpLevels);
 #else
-          Histogram[c][HistogramPoint]++;
+      uint32_t (*TpLevels)[0x100] = Levels;
 #endif
+#pragma omp for
+    for (int Row=Area.top(); Row<=Area.bottom(); Row++) {
+      const QRgb* Line =
+        (const QRgb*) m_RelatedImage->scanLine(Row) + Area.left();
+      for (int Col=0; Col<Area.width(); Col++) {
+        TpLevels[0][qRed(Line[Col])]++;
+        TpLevels[1][qGreen(Line[Col])]++;
+        TpLevels[2][qBlue(Line[Col])]++;
       }
     }
 #ifdef _OPENMP
 #pragma omp critical
-      for(int c=0; c<3*HistogramWidth; c++) {
-        Histogram[0][c]+=TpHistogram[0][c];
+      for(int c=0; c<3*0x100; c++) {
+        Levels[0][c]+=TpLevels[0][c];
       }
 #endif
     } // End omp parallel zone.
 
+  // Then spread over the columns : level v covers [v,v+1)*HistogramWidth
+  // and column k [k,k+1)*0x100, each gets its share of the overlap. So
+  // no empty columns when there are more columns than levels. The shares
+  // are rounded down on the overlap covered so far, so those of a level
+  // add up to its count.
+  for (short c=0; c<MaxColor; c++) {
+    for (uint32_t v=0; v<0x100; v++) {
+      if (!Levels[c][v]) continue;
+      const uint32_t Low     = v*HistogramWidth;
+      const uint32_t High    = Low+HistogramWidth;
+      uint32_t       Covered = 0;
+      uint32_t       Given   = 0;
+      for (uint32_t k=Low/0x100; k*0x100<High; k++) {
+        Covered += MIN(High,(k+1)*0x100)-MAX(Low,k*0x100);
+        const uint32_t Share =
+          (uint32_t)((uint64_t)Levels[c][v]*Covered/HistogramWidth);
+        Histogram[c][k] += Share-Given;
+        Given = Share;
+      }
+    }
+  }
+
   // Logaritmic variants.
   const short HistogramLogX = Settings->GetInt("HistogramLogX");
   if (HistogramLogX) {
@@ -368,9 +389,13 @@ void dlHistogramWindow::CalculateHistogram() {
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-void dlHistogramWindow::UpdateView(const dlImage* NewRelatedImage) {
+void dlHistogramWindow::UpdateView(const QImage* NewRelatedImage,
+                                   const QRect   Crop) {
 
-  if (NewRelatedImage) m_RelatedImage = NewRelatedImage;
+  if (NewRelatedImage) {
+    m_RelatedImage = NewRelatedImage;
+    m_Crop         = Crop;
+  }
   if (!m_RelatedImage) return;
 
   CalculateHistogram();
@@ -41,17 +41,21 @@ Q_OBJECT
 
 public :
 
-const dlImage*      m_RelatedImage;
+const QImage*       m_RelatedImage;
+// Part of it counted, all if empty.
+QRect               m_Crop;
 QTimer*             m_ResizeTimer; // To circumvent multi resize events.
 
 // Constructor.
-dlHistogramWindow(const dlImage* RelatedImage,
+dlHistogramWindow(const QImage*  RelatedImage,
                         QWidget* Parent);
 // Destructor.
 ~dlHistogramWindow();
 
-// NewRelatedImage to associate anonter dlImage with this window.
-void UpdateView(const dlImage* NewRelatedImage = NULL);
+// NewRelatedImage to associate another image with this window : the
+// preview as shown (8 bit RGB), of which only Crop if not empty.
+void UpdateView(const QImage* NewRelatedImage = NULL,
+                const QRect   Crop            = QRect());
 
 protected:
 void resizeEvent(QResizeEvent*);
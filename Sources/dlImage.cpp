@@ -28,7 +28,9 @@
 #include <cassert>
 #include <cfloat>
 #include <cmath>
-#include <QMessageBox>
+#include <cstring>
+
+#include <QtCore>
 
 #include <lcms2.h>
 
@@ -43,9 +45,17 @@
 #include "dlConstants.h"
 #include "dlError.h"
 #include "dlImage.h"
+#include "dlLut.h"
+#include "dlRGBLab.h"
+#include "dlTransformCache.h"
+#include "dlResize.h"
 #include "dlCurve.h"
 #include "dlConstants.h"
 
+// Pixels per block for the lookups. Multiple of the dlLut vector step,
+// 48 KB so a block is still in cache for the saturation.
+const uint32_t dlImage_LutBlock = 8192;
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Constructor.
@@ -56,6 +66,14 @@ dlImage::dlImage() {
   m_Width              = 0;
   m_Height             = 0;
   m_Image              = NULL;
+  m_Planes             = NULL;
+  m_Tiles              = NULL;
+  m_Shares             = NULL;
+  m_Abort              = NULL;
+  // Lab black, what the borders of a panorama usually are.
+  m_TileFill[0]        = 0;
+  m_TileFill[1]        = 0x8080;
+  m_TileFill[2]        = 0x8080;
   m_Depth              = 0;
   m_Colors             = 0;
   m_ColorSpace         = dlSpace_sRGB_D65;
@@ -68,9 +86,121 @@ dlImage::dlImage() {
 ////////////////////////////////////////////////////////////////////////////////
 
 dlImage::~dlImage() {
+  FreePixels();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FreePixels
+// Needs m_Width and m_Height still those of the tiles.
+// Shared pixels are freed by the last image using them.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlImage::FreePixels() {
+  if (m_Shares) {
+    const short Last = !m_Shares->deref();
+    if (Last) delete m_Shares;
+    m_Shares = NULL;
+    if (!Last) {
+      m_Image  = NULL;
+      m_Planes = NULL;
+      return;
+    }
+  }
   FREE(m_Image);
+  FREE(m_Planes);
+  if (m_Tiles) {
+    const uint64_t NrTiles = (uint64_t)NrTilesX()*NrTilesY();
+    for (uint64_t t=0; t<NrTiles; t++) FREE(m_Tiles[t]);
+    FREE(m_Tiles);
+  }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Detach
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlImage::Detach(const short Copy) {
+
+  if (!m_Shares) return;
+
+  // The others let go of them meanwhile.
+  if (*m_Shares == 1) {
+    delete m_Shares;
+    m_Shares = NULL;
+    return;
+  }
+
+  const short  Planar   = IsPlanar();
+  const size_t NrValues = 3*(size_t)m_Width*m_Height;
+  uint16_t* Pixels = (uint16_t*) CALLOC(NrValues,sizeof(*Pixels));
+  dlMemoryError(Pixels,__FILE__,__LINE__);
+  if (Copy) {
+    memcpy(Pixels,Planar ? m_Planes : (uint16_t*) m_Image,
+           NrValues*sizeof(*Pixels));
+  }
+
+  FreePixels();
+  if (Planar) {
+    m_Planes = Pixels;
+  } else {
+    m_Image  = (uint16_t (*)[3]) Pixels;
+  }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// IsShared
+// m_Shares stays set on the last user until it writes.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlImage::IsShared() const {
+  return m_Shares && *m_Shares > 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Aborted
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlImage::Aborted() const {
+  return m_Abort && *m_Abort;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SetLayout
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlImage::SetLayout(const dlImage* Origin) {
+
+  assert(Origin != this);
+  assert(!Origin->IsTiled());
+
+  FreePixels();
+
+  m_Width              = Origin->m_Width;
+  m_Height             = Origin->m_Height;
+  m_Depth              = Origin->m_Depth;
+  m_Colors             = Origin->m_Colors;
+  m_ColorSpace         = Origin->m_ColorSpace;
+
+  const size_t NrValues = 3*(size_t)m_Width*m_Height;
+  uint16_t* Pixels = (uint16_t*) CALLOC(NrValues,sizeof(*Pixels));
+  dlMemoryError(Pixels,__FILE__,__LINE__);
+  if (Origin->IsPlanar()) {
+    m_Planes = Pixels;
+  } else {
+    m_Image  = (uint16_t (*)[3]) Pixels;
+  }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -78,35 +208,39 @@ dlImage::~dlImage() {
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-dlImage* dlImage::Set(const uint16_t Width,
-                      const uint16_t Height,
+dlImage* dlImage::Set(const uint32_t Width,
+                      const uint32_t Height,
                       const short    NrColors,
                       const short    NrBytesPerColor,
                       const char*    FileName) {
 
+  // Free a maybe preexisting and allocate space.
+  FreePixels();
+
   m_Width  = Width;
   m_Height = Height;
 
-  // Free a maybe preexisting and allocate space.
-  FREE(m_Image);
-  m_Image = (uint16_t (*)[3]) CALLOC(m_Width*m_Height,sizeof(*m_Image));
+  m_Image = (uint16_t (*)[3])
+    CALLOC((size_t)m_Width*m_Height,sizeof(*m_Image));
   dlMemoryError(m_Image,__FILE__,__LINE__);
 
   uint16_t (*Buffer)[NrColors];
-  Buffer=(uint16_t (*)[NrColors])CALLOC(Width*Height,NrBytesPerColor*NrColors);
+  Buffer=(uint16_t (*)[NrColors])
+    CALLOC((size_t)Width*Height,NrBytesPerColor*NrColors);
   FILE *InputFile = fopen(FileName,"rb");
   if (!InputFile) {
     dlLogError(dlError_FileOpen,FileName);
     return NULL;
   }
-  if ((size_t)(Width*Height) !=
-       fread(Buffer,NrBytesPerColor*NrColors,Width*Height,InputFile)) {
+  if ((size_t)Width*Height !=
+       fread(Buffer,NrBytesPerColor*NrColors,(size_t)Width*Height,
+             InputFile)) {
     dlLogError(dlError_FileOpen,FileName);
     return NULL;
   }
   FCLOSE(InputFile);
 #pragma omp parallel for
-  for (uint32_t i=0; i<(uint32_t)Height*Width; i++) {
+  for (uint64_t i=0; i<(uint64_t)Height*Width; i++) {
     for (short c=0; c<3; c++) {
       m_Image[i][c] = Buffer[i][c];
       //printf("DEBUG : Buffer[i][c] : %d\n",Buffer[i][c]);
@@ -129,27 +263,244 @@ dlImage* dlImage::Set(const uint16_t Width,
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-dlImage* dlImage::Set(const dlImage *Origin) { // Always deep
+dlImage* dlImage::Set(const dlImage *Origin) {
 
   assert(NULL != Origin);
 
+  if (Origin == this) return this;
+
+  // Free a maybe preexisting.
+  FreePixels();
+
   m_Width              = Origin->m_Width;
   m_Height             = Origin->m_Height;
   m_Depth              = Origin->m_Depth;
   m_Colors             = Origin->m_Colors;
   m_ColorSpace         = Origin->m_ColorSpace;
 
-  // And a deep copying of the image.
-  // Free a maybe preexisting.
-  FREE(m_Image);
-  // Allocate new.
-  m_Image = (uint16_t (*)[3]) CALLOC(m_Width*m_Height,sizeof(*m_Image));
+  // Shared pixels, except for tiles which are copied deep.
+  if (Origin->IsTiled()) {
+    const uint64_t NrTiles = (uint64_t)NrTilesX()*NrTilesY();
+    m_Tiles = (uint16_t (**)[3]) CALLOC(NrTiles,sizeof(*m_Tiles));
+    dlMemoryError(m_Tiles,__FILE__,__LINE__);
+    memcpy(m_TileFill,Origin->m_TileFill,sizeof(m_TileFill));
+#pragma omp parallel for schedule(dynamic)
+    for (uint64_t t=0; t<NrTiles; t++) {
+      if (!Origin->m_Tiles[t]) continue;
+      m_Tiles[t] = (uint16_t (*)[3])
+        CALLOC(dlImage_TilePixels,sizeof(**m_Tiles));
+      dlMemoryError(m_Tiles[t],__FILE__,__LINE__);
+      memcpy(m_Tiles[t],Origin->m_Tiles[t],
+             dlImage_TilePixels*sizeof(**m_Tiles));
+    }
+  } else {
+    if (!Origin->m_Shares) Origin->m_Shares = new QAtomicInt(1);
+    Origin->m_Shares->ref();
+    m_Shares = Origin->m_Shares;
+    m_Image  = Origin->m_Image;
+    m_Planes = Origin->m_Planes;
+  }
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ToPlanar
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::ToPlanar() {
+
+  if (IsPlanar()) return this;
+
+  ToInterleaved();
+
+  const uint64_t NrPixels = (uint64_t)m_Width*m_Height;
+  m_Planes = (uint16_t*) CALLOC(3*NrPixels,sizeof(*m_Planes));
+  dlMemoryError(m_Planes,__FILE__,__LINE__);
+
+  uint16_t* L = Plane(0);
+  uint16_t* a = Plane(1);
+  uint16_t* b = Plane(2);
+#pragma omp parallel for schedule(static)
+  for (uint64_t i=0; i<NrPixels; i++) {
+    L[i] = m_Image[i][0];
+    a[i] = m_Image[i][1];
+    b[i] = m_Image[i][2];
+  }
+
+  uint16_t* Planes = m_Planes;
+  m_Planes = NULL;
+  FreePixels();
+  m_Planes = Planes;
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ToInterleaved
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::ToInterleaved() {
+
+  if (IsTiled()) {
+    uint16_t (*Image)[3] = (uint16_t (*)[3])
+      CALLOC((size_t)m_Width*m_Height,sizeof(*Image));
+    dlMemoryError(Image,__FILE__,__LINE__);
+
+    const uint32_t TilesX = NrTilesX();
+#pragma omp parallel for schedule(static)
+    for (uint32_t Row=0; Row<m_Height; Row++) {
+      const uint32_t TileY  = Row/dlImage_TileSize;
+      const uint32_t TileRow = Row%dlImage_TileSize;
+      uint16_t (*Target)[3] = Image + (size_t)Row*m_Width;
+      for (uint32_t TileX=0; TileX<TilesX; TileX++) {
+        const uint32_t Width = MIN(dlImage_TileSize,
+                                   m_Width-TileX*dlImage_TileSize);
+        const uint16_t (*Source)[3] = m_Tiles[(size_t)TileY*TilesX+TileX];
+        for (uint32_t Col=0; Col<Width; Col++) {
+          const uint16_t* Pixel = Source ?
+            Source[TileRow*dlImage_TileSize+Col] : m_TileFill;
+          Target[Col][0] = Pixel[0];
+          Target[Col][1] = Pixel[1];
+          Target[Col][2] = Pixel[2];
+        }
+        Target += Width;
+      }
+    }
+
+    FreePixels();
+    m_Image = Image;
+    return this;
+  }
+
+  if (!IsPlanar()) return this;
+
+  const uint64_t NrPixels = (uint64_t)m_Width*m_Height;
+  m_Image = (uint16_t (*)[3]) CALLOC(NrPixels,sizeof(*m_Image));
   dlMemoryError(m_Image,__FILE__,__LINE__);
-  memcpy(m_Image,Origin->m_Image,m_Width*m_Height*sizeof(*m_Image));
+
+  const uint16_t* L = Plane(0);
+  const uint16_t* a = Plane(1);
+  const uint16_t* b = Plane(2);
+#pragma omp parallel for schedule(static)
+  for (uint64_t i=0; i<NrPixels; i++) {
+    m_Image[i][0] = L[i];
+    m_Image[i][1] = a[i];
+    m_Image[i][2] = b[i];
+  }
+
+  uint16_t (*Image)[3] = m_Image;
+  m_Image = NULL;
+  FreePixels();
+  m_Image = Image;
   return this;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Tile
+//
+////////////////////////////////////////////////////////////////////////////////
+
+uint16_t (*dlImage::Tile(const uint32_t TileX, const uint32_t TileY))[3] {
+
+  assert(IsTiled());
+
+  uint16_t (*&Pixels)[3] = m_Tiles[(size_t)TileY*NrTilesX()+TileX];
+  if (!Pixels) {
+    Pixels = (uint16_t (*)[3]) CALLOC(dlImage_TilePixels,sizeof(*Pixels));
+    dlMemoryError(Pixels,__FILE__,__LINE__);
+    for (uint32_t i=0; i<dlImage_TilePixels; i++) {
+      Pixels[i][0] = m_TileFill[0];
+      Pixels[i][1] = m_TileFill[1];
+      Pixels[i][2] = m_TileFill[2];
+    }
+  }
+  return Pixels;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// IsFill
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlImage::IsFill(const uint16_t (*Pixels)[3],
+                      const uint32_t   NrPixels,
+                      const uint16_t   Fill[3]) {
+  for (uint32_t i=0; i<NrPixels; i++) {
+    if (Pixels[i][0] != Fill[0] ||
+        Pixels[i][1] != Fill[1] ||
+        Pixels[i][2] != Fill[2]) return 0;
+  }
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// PruneTiles
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlImage::PruneTiles() {
+
+  assert(IsTiled());
+
+  const uint64_t NrTiles = (uint64_t)NrTilesX()*NrTilesY();
+#pragma omp parallel for schedule(dynamic)
+  for (uint64_t t=0; t<NrTiles; t++) {
+    if (m_Tiles[t] && IsFill(m_Tiles[t],dlImage_TilePixels,m_TileFill)) {
+      FREE(m_Tiles[t]);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ToTiled
+// The tiles come from the interleaved image one by one, so there is
+// only one tile more in memory than the image itself.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::ToTiled() {
+
+  if (IsTiled()) return this;
+
+  ToInterleaved();
+
+  const uint32_t TilesX  = NrTilesX();
+  const uint64_t NrTiles = (uint64_t)TilesX*NrTilesY();
+  m_Tiles = (uint16_t (**)[3]) CALLOC(NrTiles,sizeof(*m_Tiles));
+  dlMemoryError(m_Tiles,__FILE__,__LINE__);
+
+#pragma omp parallel for schedule(dynamic)
+  for (uint64_t t=0; t<NrTiles; t++) {
+    const uint32_t TileX  = t%TilesX;
+    const uint32_t TileY  = t/TilesX;
+    const uint32_t Left   = TileX*dlImage_TileSize;
+    const uint32_t Top    = TileY*dlImage_TileSize;
+    const uint32_t Width  = MIN(dlImage_TileSize,m_Width-Left);
+    const uint32_t Height = MIN(dlImage_TileSize,m_Height-Top);
+    uint16_t (*Target)[3] = Tile(TileX,TileY);
+    for (uint32_t Row=0; Row<Height; Row++) {
+      memcpy(Target+Row*dlImage_TileSize,
+             m_Image+(size_t)(Top+Row)*m_Width+Left,
+             Width*sizeof(*m_Image));
+    }
+    if (IsFill(Target,dlImage_TilePixels,m_TileFill)) FREE(m_Tiles[t]);
+  }
+
+  uint16_t (**Tiles)[3] = m_Tiles;
+  m_Tiles = NULL;
+  FreePixels();
+  m_Tiles = Tiles;
+  return this;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // ApplyCurve
@@ -162,11 +513,41 @@ dlImage* dlImage::ApplyCurve(const dlCurve *Curve,
   assert (NULL != Curve);
   assert (m_Colors == 3);
   assert (m_ColorSpace != dlSpace_XYZ);
-#pragma omp parallel for default(shared)
-  for (uint32_t i=0; i< (uint32_t)m_Height*m_Width; i++) {
-    if (ChannelMask & 1) m_Image[i][0] = Curve->m_Curve[ m_Image[i][0] ];
-    if (ChannelMask & 2) m_Image[i][1] = Curve->m_Curve[ m_Image[i][1] ];
-    if (ChannelMask & 4) m_Image[i][2] = Curve->m_Curve[ m_Image[i][2] ];
+
+  Detach();
+
+  if (IsPlanar()) {
+    // Only the planes asked for are touched.
+    for (short c=0; c<3; c++) {
+      if (!(ChannelMask & (1<<c))) continue;
+      uint16_t* Values = Plane(c);
+#pragma omp parallel for default(shared) schedule(static)
+      for (uint64_t i=0; i< (uint64_t)m_Height*m_Width; i++) {
+        Values[i] = Curve->m_Curve[Values[i]];
+      }
+    }
+    return this;
+  }
+
+  const dlLut Lut((ChannelMask & 1) ? Curve->m_Curve : NULL,
+                  (ChannelMask & 2) ? Curve->m_Curve : NULL,
+                  (ChannelMask & 4) ? Curve->m_Curve : NULL);
+
+  if (IsTiled()) {
+    // The absent tiles follow by their fill.
+    const uint64_t NrTiles = (uint64_t)NrTilesX()*NrTilesY();
+#pragma omp parallel for default(shared) schedule(dynamic)
+    for (uint64_t t=0; t<NrTiles; t++) {
+      if (m_Tiles[t]) Lut.Apply(m_Tiles[t],dlImage_TilePixels);
+    }
+    Lut.Apply(&m_TileFill,1);
+    return this;
+  }
+
+  const uint64_t NrPixels = (uint64_t)m_Height*m_Width;
+#pragma omp parallel for default(shared) schedule(static)
+  for (uint64_t i=0; i<NrPixels; i+=dlImage_LutBlock) {
+    Lut.Apply(m_Image+i,(uint32_t)MIN(dlImage_LutBlock,NrPixels-i));
   }
 
   return this;
@@ -174,7 +555,66 @@ dlImage* dlImage::ApplyCurve(const dlCurve *Curve,
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// ApplyCurve
+// ApplyCurve out of place
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::ApplyCurve(const dlImage* Origin,
+                             const dlCurve* Curve,
+                             const uint8_t  ChannelMask) {
+
+  assert (NULL != Origin);
+  assert (NULL != Curve);
+
+  if (Origin == this) return ApplyCurve(Curve,ChannelMask);
+
+  // Tiles are not shared, they are copied and done in place.
+  if (Origin->IsTiled()) {
+    Set(Origin);
+    return ApplyCurve(Curve,ChannelMask);
+  }
+
+  assert (Origin->m_Colors == 3);
+  assert (Origin->m_ColorSpace != dlSpace_XYZ);
+
+  SetLayout(Origin);
+
+  const uint64_t NrPixels = (uint64_t)m_Height*m_Width;
+
+  if (IsPlanar()) {
+    for (short c=0; c<3; c++) {
+      const uint16_t* Source = Origin->Plane(c);
+      uint16_t*       Target = Plane(c);
+      if (!(ChannelMask & (1<<c))) {
+        memcpy(Target,Source,NrPixels*sizeof(*Target));
+        continue;
+      }
+#pragma omp parallel for default(shared) schedule(static)
+      for (uint64_t i=0; i<NrPixels; i++) {
+        Target[i] = Curve->m_Curve[Source[i]];
+      }
+    }
+    return this;
+  }
+
+  const dlLut Lut((ChannelMask & 1) ? Curve->m_Curve : NULL,
+                  (ChannelMask & 2) ? Curve->m_Curve : NULL,
+                  (ChannelMask & 4) ? Curve->m_Curve : NULL);
+
+  // Per block copied and then looked up while still in cache.
+#pragma omp parallel for default(shared) schedule(static)
+  for (uint64_t i=0; i<NrPixels; i+=dlImage_LutBlock) {
+    const uint32_t Length = (uint32_t)MIN(dlImage_LutBlock,NrPixels-i);
+    memcpy(m_Image+i,Origin->m_Image+i,Length*sizeof(*m_Image));
+    Lut.Apply(m_Image+i,Length);
+  }
+
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ApplySaturationCurve
 //
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -182,76 +622,259 @@ dlImage* dlImage::ApplySaturationCurve(const dlCurve *Curve,
                                        const short Mode,
                                        const short Type) {
 
-// Best solution would be to use the Lab <-> Lch conversion from lcms.
-// This should be faster without sacrificing much quality.
+  assert (m_ColorSpace == dlSpace_Lab);
+
+  if (IsTiled()) {
+    const uint64_t NrTiles = (uint64_t)NrTilesX()*NrTilesY();
+#pragma omp parallel for schedule(dynamic)
+    for (uint64_t t=0; t<NrTiles; t++) {
+      if (!m_Tiles[t]) continue;
+      for (uint32_t i=0; i<dlImage_TilePixels; i++) {
+        dlSaturate(m_Tiles[t][i],Curve,Mode,Type);
+      }
+    }
+    dlSaturate(m_TileFill,Curve,Mode,Type);
+    return this;
+  }
+
+  ToInterleaved();
+  Detach();
+
+#pragma omp parallel for schedule(static)
+  for(uint64_t i = 0; i < (uint64_t)m_Width*m_Height; i++) {
+    dlSaturate(m_Image[i],Curve,Mode,Type);
+  }
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ApplySaturationCurve out of place
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::ApplySaturationCurve(const dlImage* Origin,
+                                       const dlCurve* Curve,
+                                       const short    Mode,
+                                       const short    Type) {
+
+  assert (NULL != Origin);
+
+  if (Origin == this) return ApplySaturationCurve(Curve,Mode,Type);
+
+  // Only from interleaved, the others are converted in place.
+  if (!Origin->m_Image) {
+    Set(Origin);
+    return ApplySaturationCurve(Curve,Mode,Type);
+  }
+
+  assert (Origin->m_ColorSpace == dlSpace_Lab);
+
+  SetLayout(Origin);
+
+#pragma omp parallel for schedule(static)
+  for(uint64_t i = 0; i < (uint64_t)m_Width*m_Height; i++) {
+    m_Image[i][0] = Origin->m_Image[i][0];
+    m_Image[i][1] = Origin->m_Image[i][1];
+    m_Image[i][2] = Origin->m_Image[i][2];
+    dlSaturate(m_Image[i],Curve,Mode,Type);
+  }
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ApplyLabCurves
+// L, a, b and saturation curve in one pass over the image.
+// The memory traffic of this is what costs, not the lookups.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::ApplyLabCurves(const dlCurve*         LCurve,
+                                 const dlCurve*         aCurve,
+                                 const dlCurve*         bCurve,
+                                 const dlSaturationLut* SaturationLut) {
 
   assert (m_ColorSpace == dlSpace_Lab);
-  // neutral value for a* and b* channel
-  const float WPH = 0x8080;
-
-  float ValueA = 0.0;
-  float ValueB = 0.0;
-
-  if (Type == 0) { // by luma
-#pragma omp parallel for schedule(static) private(ValueA, ValueB)
-    for(uint32_t i = 0; i < (uint32_t) m_Width*m_Height; i++) {
-      // Factor by hue
-      ValueA = (float)m_Image[i][1]-WPH;
-      ValueB = (float)m_Image[i][2]-WPH;
-      float Hue = 0;
-      if (ValueA == 0.0 && ValueB == 0.0) {
-        Hue = 0;   // value for grey pixel
-      } else {
-        Hue = atan2f(ValueB,ValueA);
+
+  if (!LCurve && !aCurve && !bCurve && !SaturationLut) return this;
+
+  Detach();
+
+  if (IsPlanar()) return ApplyLabCurvesPlanar(LCurve,aCurve,bCurve,
+                                              SaturationLut);
+
+  const dlLut* Lut = NULL;
+  if (LCurve || aCurve || bCurve) {
+    Lut = new dlLut(LCurve ? LCurve->m_Curve : NULL,
+                    aCurve ? aCurve->m_Curve : NULL,
+                    bCurve ? bCurve->m_Curve : NULL);
+  }
+
+  if (IsTiled()) {
+    const uint64_t NrTiles = (uint64_t)NrTilesX()*NrTilesY();
+#pragma omp parallel for default(shared) schedule(dynamic)
+    for (uint64_t t=0; t<NrTiles; t++) {
+      if (!m_Tiles[t] || Aborted()) continue;
+      for (uint32_t i=0; i<dlImage_TilePixels; i+=dlImage_LutBlock) {
+        uint16_t (*Block)[3] = m_Tiles[t]+i;
+        if (Lut) Lut->Apply(Block,dlImage_LutBlock);
+        if (SaturationLut) SaturationLut->Apply(Block,dlImage_LutBlock);
       }
-      while (Hue < 0) Hue += 2.*dlPI;
-
-      float Factor = Curve->m_Curve[CLIP((int32_t)(Hue/dlPI*WPH))]/(float)0x7fff;
-      if (Factor == 1.0) continue;
-      Factor *= Factor;
-      float m = 0;
-      if (Mode == 1) {
-        float Col = powf(ValueA * ValueA + ValueB * ValueB, 0.125);
-        Col /= 0xd; // normalizing to 0..1
-
-        if (Factor > 1)
-          // work more on desaturated pixels
-          m = Factor*(1-Col)+Col;
-        else
-          // work more on saturated pixels
-          m = Factor*Col+(1-Col);
-      } else {
-        m = Factor;
+    }
+    if (Lut) Lut->Apply(&m_TileFill,1);
+    if (SaturationLut) SaturationLut->Apply(&m_TileFill,1);
+    delete Lut;
+    return this;
+  }
+
+  // Per block, so the saturation works on pixels still in cache.
+  const uint64_t NrPixels = (uint64_t)m_Height*m_Width;
+#pragma omp parallel for default(shared) schedule(static)
+  for (uint64_t i=0; i<NrPixels; i+=dlImage_LutBlock) {
+    if (Aborted()) continue;
+    const uint64_t BlockEnd = MIN(i+dlImage_LutBlock,NrPixels);
+    if (Lut) Lut->Apply(m_Image+i,BlockEnd-i);
+    if (SaturationLut) SaturationLut->Apply(m_Image+i,BlockEnd-i);
+  }
+
+  delete Lut;
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ApplyLabCurves from Origin
+// Only the channels in ChannelMask are read from Origin and written, so
+// a change of one curve costs one channel and no copy of the image.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::ApplyLabCurves(const dlImage*         Origin,
+                                 const uint8_t          ChannelMask,
+                                 const dlCurve*         LCurve,
+                                 const dlCurve*         aCurve,
+                                 const dlCurve*         bCurve,
+                                 const dlSaturationLut* SaturationLut) {
+
+  assert (NULL != Origin);
+  assert (m_ColorSpace == dlSpace_Lab);
+  assert (m_Width == Origin->m_Width && m_Height == Origin->m_Height);
+  assert (IsPlanar() == Origin->IsPlanar());
+  assert (!IsTiled() && !Origin->IsTiled());
+  assert (!SaturationLut || (ChannelMask & 6) == 6);
+
+  if (!ChannelMask) return this;
+
+  const dlCurve* Curves[3] = {LCurve,aCurve,bCurve};
+  for (short c=0; c<3; c++) {
+    if (!(ChannelMask & (1<<c))) Curves[c] = NULL;
+  }
+
+  // Nothing to apply, the same pixels as Origin.
+  if (ChannelMask == 7 && !Curves[0] && !Curves[1] && !Curves[2] &&
+      !SaturationLut) {
+    return Set(Origin);
+  }
+
+  // All channels are written, so shared pixels need no copy.
+  Detach(ChannelMask != 7);
+
+  if (IsPlanar()) return ApplyLabCurvesPlanar(Curves[0],Curves[1],Curves[2],
+                                              SaturationLut,
+                                              Origin,ChannelMask);
+
+  const dlLut* Lut = NULL;
+  if (Curves[0] || Curves[1] || Curves[2]) {
+    Lut = new dlLut(Curves[0] ? Curves[0]->m_Curve : NULL,
+                    Curves[1] ? Curves[1]->m_Curve : NULL,
+                    Curves[2] ? Curves[2]->m_Curve : NULL);
+  }
+
+  // Per block the channels are copied over and then looked up while
+  // still in cache.
+  const uint64_t NrPixels = (uint64_t)m_Height*m_Width;
+#pragma omp parallel for default(shared) schedule(static)
+  for (uint64_t i=0; i<NrPixels; i+=dlImage_LutBlock) {
+    if (Aborted()) continue;
+    const uint64_t BlockEnd = MIN(i+dlImage_LutBlock,NrPixels);
+    if (ChannelMask == 7) {
+      memcpy(m_Image+i,Origin->m_Image+i,(BlockEnd-i)*sizeof(*m_Image));
+    } else {
+      for (uint64_t j=i; j<BlockEnd; j++) {
+        for (short c=0; c<3; c++) {
+          if (ChannelMask & (1<<c)) m_Image[j][c] = Origin->m_Image[j][c];
+        }
       }
-      m_Image[i][1] = CLIP((int32_t)(m_Image[i][1] * m + WPH * (1. - m)));
-      m_Image[i][2] = CLIP((int32_t)(m_Image[i][2] * m + WPH * (1. - m)));
     }
-  } else { // by chroma
-#pragma omp parallel for schedule(static) private(ValueA, ValueB)
-    for(uint32_t i = 0; i < (uint32_t) m_Width*m_Height; i++) {
-      // Factor by luminance
-      float Factor = Curve->m_Curve[m_Image[i][0]]/(float)0x7fff;
-      if (Factor == 1.0) continue;
-      Factor *= Factor;
-      float m = 0;
-      if (Mode == 1) {
-        ValueA = (float)m_Image[i][1]-WPH;
-        ValueB = (float)m_Image[i][2]-WPH;
-        float Col = powf(ValueA * ValueA + ValueB * ValueB, 0.125);
-        Col /= 0xd; // normalizing to 0..1
-
-        if (Factor > 1)
-          // work more on desaturated pixels
-          m = Factor*(1-Col)+Col;
-        else
-          // work more on saturated pixels
-          m = Factor*Col+(1-Col);
-      } else {
-        m = Factor;
+    if (Lut) Lut->Apply(m_Image+i,BlockEnd-i);
+    if (SaturationLut) SaturationLut->Apply(m_Image+i,BlockEnd-i);
+  }
+
+  delete Lut;
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ApplyLabCurvesPlanar
+// Planar version of ApplyLabCurves. Per block the planes of the set
+// curves are looked up, the saturation (needing all three channels)
+// works on an interleaved copy of the block.
+// With Origin the planes in ChannelMask are read from there.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::ApplyLabCurvesPlanar(const dlCurve*         LCurve,
+                                       const dlCurve*         aCurve,
+                                       const dlCurve*         bCurve,
+                                       const dlSaturationLut* SaturationLut,
+                                       const dlImage*         Origin,
+                                       const uint8_t          ChannelMask) {
+
+  const dlCurve* Curves[3] = {LCurve,aCurve,bCurve};
+
+  const uint64_t NrPixels = (uint64_t)m_Height*m_Width;
+#pragma omp parallel default(shared)
+  {
+    uint16_t (*Block)[3] = NULL;
+    if (SaturationLut) {
+      Block = (uint16_t (*)[3]) CALLOC(dlImage_LutBlock,sizeof(*Block));
+      dlMemoryError(Block,__FILE__,__LINE__);
+    }
+#pragma omp for schedule(static)
+    for (uint64_t i=0; i<NrPixels; i+=dlImage_LutBlock) {
+      if (Aborted()) continue;
+      const uint32_t Length = (uint32_t)MIN(dlImage_LutBlock,NrPixels-i);
+      for (short c=0; c<3; c++) {
+        uint16_t* Values = Plane(c)+i;
+        const uint16_t* Source = Values;
+        if (Origin && (ChannelMask & (1<<c))) Source = Origin->Plane(c)+i;
+        if (Curves[c]) {
+          for (uint32_t j=0; j<Length; j++) {
+            Values[j] = Curves[c]->m_Curve[Source[j]];
+          }
+        } else if (Source != Values) {
+          memcpy(Values,Source,Length*sizeof(*Values));
+        }
+      }
+      if (SaturationLut) {
+        const uint16_t* L = Plane(0)+i;
+        uint16_t*       a = Plane(1)+i;
+        uint16_t*       b = Plane(2)+i;
+        for (uint32_t j=0; j<Length; j++) {
+          Block[j][0] = L[j];
+          Block[j][1] = a[j];
+          Block[j][2] = b[j];
+        }
+        SaturationLut->Apply(Block,Length);
+        for (uint32_t j=0; j<Length; j++) {
+          a[j] = Block[j][1];
+          b[j] = Block[j][2];
+        }
       }
-      m_Image[i][1] = CLIP((int32_t)(m_Image[i][1] * m + WPH * (1. - m)));
-      m_Image[i][2] = CLIP((int32_t)(m_Image[i][2] * m + WPH * (1. - m)));
     }
+    FREE(Block);
   }
   return this;
 }
@@ -262,26 +885,30 @@ dlImage* dlImage::ApplySaturationCurve(const dlCurve *Curve,
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-dlImage* dlImage::Crop(const uint16_t X,
-                       const uint16_t Y,
-                       const uint16_t W,
-                       const uint16_t H,
+dlImage* dlImage::Crop(const uint32_t X,
+                       const uint32_t Y,
+                       const uint32_t W,
+                       const uint32_t H,
                        const short    InPlace) {
 
   assert(m_Colors ==3);
   assert( (X+W) <= m_Width);
   assert( (Y+H) <= m_Height);
 
+  ToInterleaved();
+
   uint16_t (*CroppedImage)[3] =
-    (uint16_t (*)[3]) CALLOC(W*H,sizeof(*m_Image));
+    (uint16_t (*)[3]) CALLOC((size_t)W*H,sizeof(*m_Image));
   dlMemoryError(CroppedImage,__FILE__,__LINE__);
 
 #pragma omp parallel for schedule(static)
-  for (uint16_t Row=0;Row<H;Row++) {
-    for (uint16_t Column=0;Column<W;Column++) {
-      CroppedImage[Row*W+Column][0] = m_Image[(Y+Row)*m_Width+X+Column][0];
-      CroppedImage[Row*W+Column][1] = m_Image[(Y+Row)*m_Width+X+Column][1];
-      CroppedImage[Row*W+Column][2] = m_Image[(Y+Row)*m_Width+X+Column][2];
+  for (uint32_t Row=0;Row<H;Row++) {
+    const uint16_t (*Source)[3] = m_Image + (size_t)(Y+Row)*m_Width + X;
+    uint16_t (*Target)[3] = CroppedImage + (size_t)Row*W;
+    for (uint32_t Column=0;Column<W;Column++) {
+      Target[Column][0] = Source[Column][0];
+      Target[Column][1] = Source[Column][1];
+      Target[Column][2] = Source[Column][2];
     }
   }
 
@@ -289,7 +916,7 @@ dlImage* dlImage::Crop(const uint16_t X,
   dlImage* WorkImage = InPlace ? this : new (dlImage);
 
   if (InPlace) {
-    FREE(m_Image); // FREE the old image.
+    FreePixels(); // FREE the old image.
   }
 
   WorkImage->m_Image  = CroppedImage;
@@ -308,39 +935,68 @@ dlImage* dlImage::Crop(const uint16_t X,
 ////////////////////////////////////////////////////////////////////////////////
 
 dlImage* dlImage::Bin(const short ScaleFactor) {
+  return Bin(this,ScaleFactor);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Bin out of place
+// Reads Origin and writes the binned pixels, so Origin (for instance
+// the image as opened) is neither copied nor changed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::Bin(const dlImage* Origin,
+                      const short    ScaleFactor) {
 
-  if (ScaleFactor == 0) return this;
+  assert (NULL != Origin);
 
-  uint16_t NewHeight = m_Height >> ScaleFactor;
-  uint16_t NewWidth = m_Width >> ScaleFactor;
+  // Binning reads the interleaved layout only.
+  if (ScaleFactor == 0 || !Origin->m_Image) {
+    Set(Origin);
+    if (ScaleFactor == 0) return this;
+    ToInterleaved();
+    Origin = this;
+  }
+
+  const uint32_t Width = Origin->m_Width;
+  const uint16_t (*Image)[3] = Origin->m_Image;
+
+  uint32_t NewHeight = Origin->m_Height >> ScaleFactor;
+  uint32_t NewWidth = Width >> ScaleFactor;
 
   short Step = 1 << ScaleFactor;
   int Average = 2 * ScaleFactor;
 
   uint16_t (*NewImage)[3] =
-    (uint16_t (*)[3]) CALLOC(NewWidth*NewHeight,sizeof(*m_Image));
+    (uint16_t (*)[3]) CALLOC((size_t)NewWidth*NewHeight,sizeof(*m_Image));
   dlMemoryError(NewImage,__FILE__,__LINE__);
 
 #pragma omp parallel for schedule(static)
-  for (uint16_t Row=0; Row < NewHeight*Step; Row+=Step) {
-    for (uint16_t Col=0; Col < NewWidth*Step; Col+=Step) {
+  for (uint32_t Row=0; Row < NewHeight*Step; Row+=Step) {
+    if (Aborted()) continue;
+    for (uint32_t Col=0; Col < NewWidth*Step; Col+=Step) {
       uint32_t  PixelValue[3] = {0,0,0};
       for (uint8_t sRow=0; sRow < Step; sRow++) {
         for (uint8_t sCol=0; sCol < Step; sCol++) {
-          int32_t index = (Row+sRow)*m_Width+Col+sCol;
+          size_t index = (size_t)(Row+sRow)*Width+Col+sCol;
           for (short c=0; c < 3; c++) {
-            PixelValue[c] += m_Image[index][c];
+            PixelValue[c] += Image[index][c];
           }
         }
       }
       for (short c=0; c < 3; c++) {
-        NewImage[Row/Step*NewWidth+Col/Step][c]
+        NewImage[(size_t)(Row/Step)*NewWidth+Col/Step][c]
           = PixelValue[c] >> Average;
       }
     }
   }
 
-  FREE(m_Image);
+  // Origin is no longer read, it may be this.
+  FreePixels();
+  m_Depth      = Origin->m_Depth;
+  m_Colors     = Origin->m_Colors;
+  m_ColorSpace = Origin->m_ColorSpace;
   m_Height = NewHeight;
   m_Width = NewWidth;
   m_Image = NewImage;
@@ -348,6 +1004,191 @@ dlImage* dlImage::Bin(const short ScaleFactor) {
   return this;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// BinPyramid
+// The sums of 2x2 pixels of a level give the next one. They are kept
+// unshifted, so each level equals binning this image directly.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlImage::BinPyramid(dlImage* Levels[4]) const {
+
+  assert (Levels[1] && Levels[2] && Levels[3]);
+
+  // Binning reads the interleaved layout only.
+  if (!m_Image) {
+    for (short s=1; s<=3; s++) Levels[s]->Bin(this,s);
+    return;
+  }
+
+  uint32_t Width[4];
+  uint32_t Height[4];
+  uint16_t (*NewImage[4])[3];
+  for (short s=1; s<=3; s++) {
+    Width[s]  = m_Width  >> s;
+    Height[s] = m_Height >> s;
+    NewImage[s] = (uint16_t (*)[3])
+      CALLOC((size_t)Width[s]*Height[s],sizeof(*m_Image));
+    dlMemoryError(NewImage[s],__FILE__,__LINE__);
+  }
+
+  // Band b : rows 4b..4b+3 of the half level, 2b..2b+1 of the quarter
+  // and b of the eighth, as far as they exist.
+  const uint32_t NrBands = (Height[1]+3)/4;
+
+#pragma omp parallel
+  {
+    // Sums of the band, for the half and the quarter level.
+    uint32_t (*Sum1)[3] =
+      (uint32_t (*)[3]) CALLOC((size_t)4*Width[1],sizeof(*Sum1));
+    dlMemoryError(Sum1,__FILE__,__LINE__);
+    uint32_t (*Sum2)[3] =
+      (uint32_t (*)[3]) CALLOC((size_t)2*Width[2],sizeof(*Sum2));
+    dlMemoryError(Sum2,__FILE__,__LINE__);
+
+#pragma omp for schedule(static)
+    for (uint32_t Band=0; Band < NrBands; Band++) {
+      const uint32_t Rows1 = MIN(4,Height[1]-4*Band);
+      for (uint32_t r=0; r<Rows1; r++) {
+        const uint32_t Row = 4*Band+r;
+        const uint16_t (*Line0)[3] = m_Image+(size_t)(2*Row)*m_Width;
+        const uint16_t (*Line1)[3] = Line0+m_Width;
+        uint32_t (*Sum)[3] = Sum1+(size_t)r*Width[1];
+        uint16_t (*Out)[3] = NewImage[1]+(size_t)Row*Width[1];
+        for (uint32_t Col=0; Col<Width[1]; Col++) {
+          for (short c=0; c<3; c++) {
+            Sum[Col][c] = Line0[2*Col][c] + Line0[2*Col+1][c] +
+                          Line1[2*Col][c] + Line1[2*Col+1][c];
+            Out[Col][c] = Sum[Col][c] >> 2;
+          }
+        }
+      }
+
+      const uint32_t Rows2 =
+        (2*Band < Height[2]) ? MIN(2,Height[2]-2*Band) : 0;
+      for (uint32_t r=0; r<Rows2; r++) {
+        const uint32_t Row = 2*Band+r;
+        const uint32_t (*Line0)[3] = Sum1+(size_t)(2*r)*Width[1];
+        const uint32_t (*Line1)[3] = Line0+Width[1];
+        uint32_t (*Sum)[3] = Sum2+(size_t)r*Width[2];
+        uint16_t (*Out)[3] = NewImage[2]+(size_t)Row*Width[2];
+        for (uint32_t Col=0; Col<Width[2]; Col++) {
+          for (short c=0; c<3; c++) {
+            Sum[Col][c] = Line0[2*Col][c] + Line0[2*Col+1][c] +
+                          Line1[2*Col][c] + Line1[2*Col+1][c];
+            Out[Col][c] = Sum[Col][c] >> 4;
+          }
+        }
+      }
+
+      if (Band < Height[3]) {
+        const uint32_t (*Line0)[3] = Sum2;
+        const uint32_t (*Line1)[3] = Sum2+Width[2];
+        uint16_t (*Out)[3] = NewImage[3]+(size_t)Band*Width[3];
+        for (uint32_t Col=0; Col<Width[3]; Col++) {
+          for (short c=0; c<3; c++) {
+            Out[Col][c] = (Line0[2*Col][c] + Line0[2*Col+1][c] +
+                           Line1[2*Col][c] + Line1[2*Col+1][c]) >> 6;
+          }
+        }
+      }
+    }
+    FREE(Sum1);
+    FREE(Sum2);
+  }
+
+  for (short s=1; s<=3; s++) {
+    Levels[s]->FreePixels();
+    Levels[s]->m_Depth      = m_Depth;
+    Levels[s]->m_Colors     = m_Colors;
+    Levels[s]->m_ColorSpace = m_ColorSpace;
+    Levels[s]->m_Width      = Width[s];
+    Levels[s]->m_Height     = Height[s];
+    Levels[s]->m_Image      = NewImage[s];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FilteredScale
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::FilteredScale(const float Factor,
+                                const short Filter) {
+
+  assert (Factor > 0.0);
+
+  if (fabs(Factor-1.0) < 0.01) return this;
+
+  ToInterleaved();
+
+  const uint32_t NewWidth  = MAX((uint32_t)(m_Width*Factor+0.5),1u);
+  const uint32_t NewHeight = MAX((uint32_t)(m_Height*Factor+0.5),1u);
+
+  uint16_t (*NewImage)[3] =
+    (uint16_t (*)[3]) CALLOC((size_t)NewWidth*NewHeight,sizeof(*m_Image));
+  dlMemoryError(NewImage,__FILE__,__LINE__);
+
+  dlResize(m_Image,m_Width,m_Height,Factor,
+           0,0,NewWidth,NewHeight,NewImage,Filter);
+
+  FreePixels();
+  m_Width  = NewWidth;
+  m_Height = NewHeight;
+  m_Image  = NewImage;
+
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Expand
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::Expand(const dlImage* Origin,
+                         const short    ScaleFactor,
+                         const uint32_t Width,
+                         const uint32_t Height) {
+
+  assert (NULL != Origin);
+  assert (Origin->m_Image && Origin->m_Width && Origin->m_Height);
+
+  const uint32_t OriginWidth  = Origin->m_Width;
+  const uint32_t OriginHeight = Origin->m_Height;
+  const uint16_t (*Image)[3]  = Origin->m_Image;
+
+  uint16_t (*NewImage)[3] =
+    (uint16_t (*)[3]) CALLOC((size_t)Width*Height,sizeof(*m_Image));
+  dlMemoryError(NewImage,__FILE__,__LINE__);
+
+#pragma omp parallel for schedule(static)
+  for (uint32_t Row=0; Row < Height; Row++) {
+    const uint32_t OriginRow = MIN(Row>>ScaleFactor,OriginHeight-1);
+    const uint16_t (*Line)[3] = Image+(size_t)OriginRow*OriginWidth;
+    uint16_t (*NewLine)[3] = NewImage+(size_t)Row*Width;
+    for (uint32_t Col=0; Col < Width; Col++) {
+      const uint32_t OriginCol = MIN(Col>>ScaleFactor,OriginWidth-1);
+      NewLine[Col][0] = Line[OriginCol][0];
+      NewLine[Col][1] = Line[OriginCol][1];
+      NewLine[Col][2] = Line[OriginCol][2];
+    }
+  }
+
+  // Origin is no longer read, it may be this.
+  FreePixels();
+  m_Depth      = Origin->m_Depth;
+  m_Colors     = Origin->m_Colors;
+  m_ColorSpace = Origin->m_ColorSpace;
+  m_Height = Height;
+  m_Width = Width;
+  m_Image = NewImage;
+
+  return this;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // LabtoRGB simple
@@ -356,33 +1197,194 @@ dlImage* dlImage::Bin(const short ScaleFactor) {
 
 dlImage* dlImage::lcmsLabToRGBSimple() {
 
-  cmsHPROFILE InProfile = cmsCreateLab4Profile(NULL);
-  cmsHPROFILE OutProfile = cmsCreate_sRGBProfile();
+  ToInterleaved();
+  Detach();
 
   cmsHTRANSFORM Transform;
-  Transform = cmsCreateTransform(InProfile,
-                                 TYPE_Lab_16,
-                                 OutProfile,
-                                 TYPE_RGB_16,
-                                 INTENT_PERCEPTUAL,
-                                 cmsFLAGS_BLACKPOINTCOMPENSATION);
-
-  int32_t Size = m_Width*m_Height;
-  int32_t Step = 100000;
-#pragma omp parallel for schedule(static)
-  for (int32_t i = 0; i < Size; i+=Step) {
+  Transform = dlTransformCache::Get(NULL,0,TYPE_Lab_16,
+                                    NULL,0,TYPE_RGB_16,
+                                    INTENT_PERCEPTUAL,
+                                    cmsFLAGS_BLACKPOINTCOMPENSATION);
+  if (!Transform) return this;
+
+  // Computed sRGB, unless it does not match the one of lcms.
+  const dlRGBLab* Analytic = dlRGBLab::Get(NULL,0);
+
+  int64_t Size = (int64_t)m_Width*m_Height;
+  if (Analytic) {
+    int32_t Step = dlTransformCache::ChunkPixels(Size);
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < Size; i+=Step) {
+      int32_t Length = (i+Step)<Size ? Step : Size - i;
+      Analytic->FromLab(m_Image+i,Length);
+    }
+  } else {
+    dlTransformCache::Run(Transform,m_Image,m_Image,Size);
+  }
+
+  m_ColorSpace = dlSpace_sRGB_D65;
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Lab to the display, through the table.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::LabToDisplay(const dlDisplayLut* Lut) {
+
+  ToInterleaved();
+  Detach();
+
+  int64_t Size = (int64_t)m_Width*m_Height;
+  int32_t Step = dlTransformCache::ChunkPixels(Size);
+#pragma omp parallel for schedule(dynamic)
+  for (int64_t i = 0; i < Size; i+=Step) {
+    if (Aborted()) continue;
     int32_t Length = (i+Step)<Size ? Step : Size - i;
-    uint16_t* Image = &m_Image[i][0];
-    cmsDoTransform(Transform,Image,Image,Length);
+    Lut->Apply(&m_Image[i],Length);
   }
 
-  cmsDeleteTransform(Transform);
-  cmsCloseProfile(InProfile);
-  cmsCloseProfile(OutProfile);
   m_ColorSpace = dlSpace_sRGB_D65;
   return this;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabToScreen
+// Row by row, so each thread writes its own scanlines. Expanded, a row
+// is converted once into a line of its own and repeated from there.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlImage::LabToScreen(const dlDisplayLut* Lut,
+                          const short         ViewLAB,
+                          uint8_t*            Bits,
+                          const int32_t       BytesPerLine,
+                          const short         ScaleFactor,
+                          const uint32_t      Width,
+                          const uint32_t      Height) const {
+
+  assert (m_ColorSpace == dlSpace_Lab);
+  assert (Bits);
+
+  if (IsTiled()) {
+    // Not for the preview sizes : through an interleaved copy.
+    dlImage Copy;
+    Copy.m_Abort = m_Abort;
+    Copy.Set(this);
+    Copy.ToInterleaved();
+    Copy.LabToScreen(Lut,ViewLAB,Bits,BytesPerLine,ScaleFactor,Width,Height);
+    return;
+  }
+
+  const int32_t Step = IsPlanar() ? 1 : 3;
+  const uint16_t* Lab[3];
+  for (short c=0; c<3; c++) Lab[c] = IsPlanar() ? Plane(c) : m_Image[0]+c;
+
+  const uint32_t SourceWidth  = m_Width;
+  const uint32_t SourceHeight = m_Height;
+
+#pragma omp parallel
+  {
+    uint32_t* Line = NULL;
+    if (ScaleFactor) {
+      Line = (uint32_t*) CALLOC(SourceWidth,sizeof(*Line));
+      dlMemoryError(Line,__FILE__,__LINE__);
+    }
+
+#pragma omp for schedule(static)
+    for (uint32_t Row=0; Row<SourceHeight; Row++) {
+      if (Aborted()) continue;
+      const size_t Offset = (size_t)Row*SourceWidth*Step;
+      const uint16_t* const RowLab[3] = {Lab[0]+Offset,
+                                         Lab[1]+Offset,
+                                         Lab[2]+Offset};
+      if (!ScaleFactor) {
+        Lut->Apply(RowLab,Step,ViewLAB,
+                   (uint32_t*) (Bits+(size_t)Row*BytesPerLine),SourceWidth);
+        continue;
+      }
+      Lut->Apply(RowLab,Step,ViewLAB,Line,SourceWidth);
+      // The rows Expand takes from this one, the last row also those
+      // Bin dropped.
+      const uint32_t First = Row<<ScaleFactor;
+      const uint32_t Last  = (Row == SourceHeight-1) ?
+        Height : MIN(Height,(Row+1)<<ScaleFactor);
+      for (uint32_t OutRow=First; OutRow<Last; OutRow++) {
+        uint32_t* Out = (uint32_t*) (Bits+(size_t)OutRow*BytesPerLine);
+        for (uint32_t Col=0; Col<Width; Col++) {
+          Out[Col] = Line[MIN(Col>>ScaleFactor,SourceWidth-1)];
+        }
+      }
+    }
+
+    FREE(Line);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Lab to output profile
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::lcmsLabToProfile(const uint8_t* ProfileBuffer,
+                                   const long     ProfileSize) {
+
+  assert (m_ColorSpace == dlSpace_Lab);
+
+  // Tiles are transformed as they are.
+  if (!IsTiled()) ToInterleaved();
+  Detach();
+
+  // sRGB if there is no (usable) profile.
+  cmsHTRANSFORM Transform;
+  Transform = dlTransformCache::Get(NULL,0,TYPE_Lab_16,
+                                    ProfileBuffer,ProfileSize,TYPE_RGB_16,
+                                    INTENT_PERCEPTUAL,
+                                    cmsFLAGS_BLACKPOINTCOMPENSATION);
+  if (!Transform) return NULL;
+
+  // Computed instead if the profile is one of the built in spaces.
+  const dlRGBLab* Analytic = dlRGBLab::Get(ProfileBuffer,ProfileSize);
+
+  if (IsTiled()) {
+    const int64_t NrTiles = (int64_t)NrTilesX()*NrTilesY();
+#pragma omp parallel for schedule(dynamic)
+    for (int64_t t = 0; t < NrTiles; t++) {
+      if (!m_Tiles[t]) continue;
+      if (Analytic) {
+        Analytic->FromLab(m_Tiles[t],dlImage_TilePixels);
+      } else {
+        dlTransformCache::RunLines(Transform,m_Tiles[t],m_Tiles[t],
+                                   dlImage_TilePixels,1,0,0);
+      }
+    }
+    if (Analytic) {
+      Analytic->FromLab(&m_TileFill,1);
+    } else {
+      cmsDoTransform(Transform,m_TileFill,m_TileFill,1);
+    }
+  } else {
+    int64_t Size = (int64_t)m_Width*m_Height;
+    if (Analytic) {
+      int32_t Step = dlTransformCache::ChunkPixels(Size);
+#pragma omp parallel for schedule(dynamic)
+      for (int64_t i = 0; i < Size; i+=Step) {
+        int32_t Length = (i+Step)<Size ? Step : Size - i;
+        Analytic->FromLab(m_Image+i,Length);
+      }
+    } else {
+      dlTransformCache::Run(Transform,m_Image,m_Image,Size);
+    }
+  }
+
+  m_ColorSpace = dlSpace_Profiled;
+  return this;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // ViewLAB
@@ -393,11 +1395,38 @@ dlImage* dlImage::ViewLAB(const short Channel) {
 
   assert (m_ColorSpace == dlSpace_Lab);
 
+  if (Channel != dlViewLAB_L &&
+      Channel != dlViewLAB_A &&
+      Channel != dlViewLAB_B) return this;
+
+  Detach();
+
+  if (IsPlanar()) {
+    // 0x8080 has equal bytes, so memset fills the neutral a and b.
+    const size_t PlaneSize = (size_t)m_Width*m_Height*sizeof(*m_Planes);
+    switch(Channel) {
+      case dlViewLAB_L:
+        break;
+      case dlViewLAB_A:
+        memcpy(Plane(0),Plane(1),PlaneSize);
+        break;
+      case dlViewLAB_B:
+        memcpy(Plane(0),Plane(2),PlaneSize);
+        break;
+      default:
+        return this;
+    }
+    memset(Plane(1),0x80,2*PlaneSize);
+    return this;
+  }
+
+  ToInterleaved();
+
   switch(Channel) {
 
     case dlViewLAB_L:
 #pragma omp parallel for schedule(static)
-      for (uint32_t i=0; i<(uint32_t) m_Height*m_Width; i++) {
+      for (uint64_t i=0; i<(uint64_t)m_Height*m_Width; i++) {
         m_Image[i][1]=0x8080;
         m_Image[i][2]=0x8080;
       }
@@ -405,7 +1434,7 @@ dlImage* dlImage::ViewLAB(const short Channel) {
 
     case dlViewLAB_A:
 #pragma omp parallel for schedule(static)
-      for (uint32_t i=0; i<(uint32_t) m_Height*m_Width; i++) {
+      for (uint64_t i=0; i<(uint64_t)m_Height*m_Width; i++) {
         m_Image[i][0]=m_Image[i][1];
         m_Image[i][1]=0x8080;
         m_Image[i][2]=0x8080;
@@ -414,7 +1443,7 @@ dlImage* dlImage::ViewLAB(const short Channel) {
 
     case dlViewLAB_B:
 #pragma omp parallel for schedule(static)
-      for (uint32_t i=0; i<(uint32_t) m_Height*m_Width; i++) {
+      for (uint64_t i=0; i<(uint64_t)m_Height*m_Width; i++) {
         m_Image[i][0]=m_Image[i][2];
         m_Image[i][1]=0x8080;
         m_Image[i][2]=0x8080;
@@ -429,3 +1458,49 @@ dlImage* dlImage::ViewLAB(const short Channel) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
+//
+// ViewLAB out of place
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage* dlImage::ViewLAB(const dlImage* Origin,
+                          const short    Channel) {
+
+  assert (NULL != Origin);
+  assert (Origin->m_ColorSpace == dlSpace_Lab);
+
+  if (Origin == this) return ViewLAB(Channel);
+
+  short Source = 0;
+  switch(Channel) {
+    case dlViewLAB_L: Source = 0; break;
+    case dlViewLAB_A: Source = 1; break;
+    case dlViewLAB_B: Source = 2; break;
+    default: return Set(Origin);
+  }
+
+  if (Origin->IsTiled()) {
+    Set(Origin);
+    return ViewLAB(Channel);
+  }
+
+  SetLayout(Origin);
+
+  if (IsPlanar()) {
+    const size_t PlaneSize = (size_t)m_Width*m_Height*sizeof(*m_Planes);
+    memcpy(Plane(0),Origin->Plane(Source),PlaneSize);
+    memset(Plane(1),0x80,2*PlaneSize);
+    return this;
+  }
+
+#pragma omp parallel for schedule(static)
+  for (uint64_t i=0; i<(uint64_t)m_Height*m_Width; i++) {
+    m_Image[i][0]=Origin->m_Image[i][Source];
+    m_Image[i][1]=0x8080;
+    m_Image[i][2]=0x8080;
+  }
+
+  return this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -24,12 +24,21 @@
 #ifndef DLIMAGE_H
 #define DLIMAGE_H
 
+#include <cstddef>
+
 #include "dlDefines.h"
 #include "dlConstants.h"
 
 // A forward declaration to the curve class.
 
 class dlCurve;
+class dlSaturationLut;
+class dlDisplayLut;
+class QAtomicInt;
+
+// Side of the square tiles of the tiled layout, in pixels.
+const uint32_t dlImage_TileSize   = 256;
+const uint32_t dlImage_TilePixels = dlImage_TileSize*dlImage_TileSize;
 
 // Class containing an image and its operations.
 
@@ -43,9 +52,26 @@ public:
 // [2] = B
 uint16_t (*m_Image)[3];
 
-// Width and height of the image
-uint16_t m_Width;
-uint16_t m_Height;
+// Planar alternative to m_Image : the 3 channels one after the other,
+// m_Width*m_Height values each. Exactly one of m_Image and m_Planes is
+// set. Operations without a planar version, and anything handing the
+// image to lcms or GraphicsMagick, convert back to interleaved first.
+uint16_t* m_Planes;
+
+// Tiled alternative for images too large to hold in one piece :
+// NrTilesX()*NrTilesY() tiles, row major, each dlImage_TileSize
+// squared interleaved pixels (also at the right and bottom edge).
+// A tile is only allocated once written, a tile that is NULL has all
+// pixels equal to m_TileFill. So the empty borders of a stitched
+// panorama take no memory. Exactly one of m_Image, m_Planes and
+// m_Tiles is set.
+uint16_t (**m_Tiles)[3];
+uint16_t m_TileFill[3];
+
+// Width and height of the image. Pixel counts are 64 bit,
+// as m_Width*m_Height does not fit 32 bit for large panoramas.
+uint32_t m_Width;
+uint32_t m_Height;
 
 // Bit depth at input time
 short m_Depth;
@@ -63,6 +89,12 @@ short m_Colors;
 //   dlSpace_XYZ              11
 short m_ColorSpace;
 
+// When set and non zero, the long operations (Bin, the Lab curves,
+// LabToDisplay and LabToScreen) skip their remaining chunks, leaving the
+// pixels (or scanlines) incomplete. For a pipe whose result is no longer
+// wanted.
+const QAtomicInt* m_Abort;
+
 // Constructor
 dlImage();
 
@@ -70,21 +102,50 @@ dlImage();
 ~dlImage();
 
 // Initialize it from another image.
-// Copying is always deep (so including copying the image).
+// The pixels are shared with Origin, not copied : whichever of the two
+// is changed first gets its own copy then (copy on write). Tiled images
+// are copied right away.
 dlImage* Set(const dlImage *Origin);
 
 // Initialize it from a dropped image (fwrite dropped).
-dlImage* Set(const uint16_t Width,
-             const uint16_t Height,
+dlImage* Set(const uint32_t Width,
+             const uint32_t Height,
              const short    NrColors,
              const short    NrBytesPerColor,
              const char*    FileName);
 
+// Gives the image its own pixels if they are shared, copied if Copy.
+// The operations of dlImage call it before writing pixels, code writing
+// m_Image or m_Planes from outside has to call it too.
+void  Detach(const short Copy = 1);
+short IsShared() const;
+
+// Planar layout access.
+short     IsPlanar() const { return m_Planes != NULL; }
+uint16_t* Plane(const short Channel) const {
+  return m_Planes + Channel*(size_t)m_Width*m_Height;
+}
+
+// Tiled layout access. Tile() allocates the tile if needed.
+short    IsTiled() const { return m_Tiles != NULL; }
+uint32_t NrTilesX() const {
+  return (m_Width+dlImage_TileSize-1)/dlImage_TileSize;
+}
+uint32_t NrTilesY() const {
+  return (m_Height+dlImage_TileSize-1)/dlImage_TileSize;
+}
+uint16_t (*Tile(const uint32_t TileX, const uint32_t TileY))[3];
+
+// Conversion between the layouts. Nop if already in that layout.
+dlImage* ToPlanar();
+dlImage* ToInterleaved();
+dlImage* ToTiled();
+
 // Crop
-dlImage* Crop(const uint16_t X,
-              const uint16_t Y,
-              const uint16_t W,
-              const uint16_t H,
+dlImage* Crop(const uint32_t X,
+              const uint32_t Y,
+              const uint32_t W,
+              const uint32_t H,
               const short    InPlace=1);
 
 // Apply a curve to an image.
@@ -97,22 +158,129 @@ dlImage* ApplySaturationCurve(const dlCurve *Curve,
                               const short Mode,
                               const short Type);
 
+// The out of place versions of ApplyCurve, ApplySaturationCurve, Bin
+// and ViewLAB : this becomes the result of the operation on Origin,
+// which is left as it is. This saves copying Origin first.
+dlImage* ApplyCurve(const dlImage* Origin,
+                    const dlCurve* Curve,
+                    const uint8_t  ChannelMask);
+
+dlImage* ApplySaturationCurve(const dlImage* Origin,
+                              const dlCurve* Curve,
+                              const short    Mode,
+                              const short    Type);
+
+dlImage* Bin(const dlImage* Origin,
+             const short    ScaleFactor);
+
+// Levels[s] becomes Bin(this,s) for s of 1 to 3 (half, quarter and
+// eighth), in a single pass over this image : each band of 8 rows is
+// read once and summed into the three levels. Levels[0] is not used.
+void BinPyramid(dlImage* Levels[4]) const;
+
+dlImage* ViewLAB(const dlImage* Origin,
+                 const short    Channel);
+
+// L, a, b curve and saturation (from its tables) in a single pass,
+// Lab only. A NULL curve is not applied.
+dlImage* ApplyLabCurves(const dlCurve*         LCurve,
+                        const dlCurve*         aCurve,
+                        const dlCurve*         bCurve,
+                        const dlSaturationLut* SaturationLut);
+
+// As above, but the channels in ChannelMask are taken again from Origin
+// (same size and layout, not tiled) before their curve, the others are
+// kept as they are and their curves not applied. Saturation needs a and
+// b in the mask. For the Lab phase, redoing only what changed.
+dlImage* ApplyLabCurves(const dlImage*         Origin,
+                        const uint8_t          ChannelMask,
+                        const dlCurve*         LCurve,
+                        const dlCurve*         aCurve,
+                        const dlCurve*         bCurve,
+                        const dlSaturationLut* SaturationLut);
+
 dlImage* Bin(const short ScaleFactor);
 
+// Resize by Factor (also > 1) through Filter (dlResizeFilter_xxx),
+// separable and over the threads (dlResize). Comes back interleaved.
+dlImage* FilteredScale(const float Factor,
+                       const short Filter = dlResizeFilter_Triangle);
+
+// The reverse of Bin : each pixel of Origin (interleaved) repeated
+// 2^ScaleFactor times in both directions, to Width x Height (the size
+// it was binned from, the last row and column repeat for what Bin
+// dropped). Origin may be this.
+dlImage* Expand(const dlImage* Origin,
+                const short    ScaleFactor,
+                const uint32_t Width,
+                const uint32_t Height);
+
 dlImage* lcmsLabToRGBSimple();
 
+// As lcmsLabToRGBSimple, from the table of Lut. For the preview.
+dlImage* LabToDisplay(const dlDisplayLut* Lut);
+
+// This Lab image to the screen in one pass, as dlDisplayLut::Apply :
+// read from the pixels (or planes) as they are, with the View LAB
+// isolation (dlViewLAB_xxx) on the way, into Bits, rows BytesPerLine
+// apart, as the scanlines of a QImage::Format_RGB32. That is of the same
+// size, or with ScaleFactor of Width x Height, each pixel repeated as by
+// Expand. No 16 bit result is made.
+void     LabToScreen(const dlDisplayLut* Lut,
+                     const short         ViewLAB,
+                     uint8_t*            Bits,
+                     const int32_t       BytesPerLine,
+                     const short         ScaleFactor = 0,
+                     const uint32_t      Width       = 0,
+                     const uint32_t      Height      = 0) const;
+
+// Lab to the output profile given as ICC buffer (sRGB if there is none).
+// NULL if there is no transform, the image is left in Lab then.
+dlImage* lcmsLabToProfile(const uint8_t* ProfileBuffer,
+                          const long     ProfileSize);
+
 // View LAB
 dlImage* ViewLAB(const short Channel);
 
+// Tiled decodes tile row by tile row into the tiled layout, without
+// the full size float buffer.
 dlImage* dlGMOpenImage(const char* FileName,
                        long& ProfileSize,
                        uint8_t* &ProfileBuffer,
-                       int& Success);
+                       int& Success,
+                       const short Tiled=0);
 
+// NULL if the file could not be written.
 dlImage* dlGMCWriteImage(const char* FileName,
                          const uint8_t* ProfileBuffer,
                          const long ProfileSize);
 
+private:
+// Number of images sharing the pixels, NULL while not shared. Set
+// creates it on Origin, hence mutable.
+mutable QAtomicInt* m_Shares;
+
+// m_Abort is set and non zero.
+short    Aborted() const;
+
+// Releases whatever layout holds the pixels (or this image's share).
+void     FreePixels();
+// Takes size, properties and layout (interleaved or planar) of Origin,
+// with pixels not yet set. For the out of place operations.
+void     SetLayout(const dlImage* Origin);
+// Drops the tiles that hold nothing but m_TileFill.
+void     PruneTiles();
+// Are all NrPixels equal to Fill ?
+static short IsFill(const uint16_t (*Pixels)[3],
+                    const uint32_t   NrPixels,
+                    const uint16_t   Fill[3]);
+dlImage* ApplyLabCurvesPlanar(const dlCurve*         LCurve,
+                              const dlCurve*         aCurve,
+                              const dlCurve*         bCurve,
+                              const dlSaturationLut* SaturationLut,
+                              const dlImage*         Origin      = NULL,
+                              const uint8_t          ChannelMask = 7);
+
 };
 
 #endif
@@ -26,6 +26,7 @@
 #include "dlError.h"
 #include "dlImage8.h"
 #include "dlImage.h"
+#include "dlResize.h"
 #include "cmath"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -48,8 +49,8 @@ m_ColorSpace         = dlSpace_sRGB_D65;
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-dlImage8::dlImage8(const uint16_t Width,
-                   const uint16_t Height,
+dlImage8::dlImage8(const uint32_t Width,
+                   const uint32_t Height,
                    const short    NrColors) {
   m_Width              = Width;
   m_Height             = Height;
@@ -57,7 +58,7 @@ dlImage8::dlImage8(const uint16_t Width,
   m_Colors             = NrColors;
   m_ColorSpace         = dlSpace_sRGB_D65;
 
-  m_Image = (uint8_t (*)[4]) CALLOC(m_Width*m_Height,sizeof(*m_Image));
+  m_Image = (uint8_t (*)[4]) CALLOC((size_t)m_Width*m_Height,sizeof(*m_Image));
   dlMemoryError(m_Image,__FILE__,__LINE__);
 };
 
@@ -90,8 +91,9 @@ dlImage8* dlImage8::Set(const dlImage *Origin) { // Always deep
   // Free maybe preexisting.
   FREE(m_Image);
 
-  m_Image = (uint8_t (*)[4]) CALLOC(m_Width*m_Height,sizeof(*m_Image));
-  for (uint32_t i=0 ; i<(uint32_t)m_Width*m_Height; i++) {
+  m_Image = (uint8_t (*)[4]) CALLOC((size_t)m_Width*m_Height,sizeof(*m_Image));
+  dlMemoryError(m_Image,__FILE__,__LINE__);
+  for (uint64_t i=0 ; i<(uint64_t)m_Width*m_Height; i++) {
     for (short c=0; c<3; c++) {
       // Mind the R<->B swap !
       m_Image[i][2-c] = Origin->m_Image[i][c]>>8;
@@ -115,21 +117,21 @@ dlImage8* dlImage8::SimpleScale(const float Factor) {
 
   if (fabs(Factor-1.0) < 0.01 ) return this;
 
-  uint16_t   Divider = MAX(m_Height,m_Width);
-  uint16_t   Multiplier = (uint16_t)(Divider*Factor);
-  uint32_t   Normalizer = Divider * Divider;
+  uint64_t   Divider = MAX(m_Height,m_Width);
+  uint64_t   Multiplier = (uint64_t)(Divider*Factor);
+  uint64_t   Normalizer = Divider * Divider;
 
-  uint16_t NewHeight = m_Height * Multiplier / Divider;
-  uint16_t NewWidth  = m_Width  * Multiplier / Divider;
+  uint32_t NewHeight = m_Height * Multiplier / Divider;
+  uint32_t NewWidth  = m_Width  * Multiplier / Divider;
 
   uint64_t (*Image64Bit)[3] =
-    (uint64_t (*)[3]) CALLOC(NewWidth*NewHeight,sizeof(*Image64Bit));
+    (uint64_t (*)[3]) CALLOC((size_t)NewWidth*NewHeight,sizeof(*Image64Bit));
   dlMemoryError(Image64Bit,__FILE__,__LINE__);
 
-  for(uint16_t r=0; r<m_Height; r++) {
+  for(uint32_t r=0; r<m_Height; r++) {
     /* r should be divided between ri and rii */
-    uint16_t ri  = r * Multiplier / Divider;
-    uint16_t rii = (r+1) * Multiplier / Divider;
+    uint32_t ri  = r * Multiplier / Divider;
+    uint32_t rii = (r+1) * Multiplier / Divider;
     /* with weights riw and riiw (riw+riiw==Multiplier) */
     int64_t riw  = rii * Divider - r * Multiplier;
     int64_t riiw = (r+1) * Multiplier - rii * Divider;
@@ -141,9 +143,9 @@ dlImage8* dlImage8::SimpleScale(const float Factor) {
       ri  = NewHeight-1;
       riw = 0;
     }
-    for(uint16_t c=0; c<m_Width; c++) {
-      uint16_t ci   = c * Multiplier / Divider;
-      uint16_t cii  = (c+1) * Multiplier / Divider;
+    for(uint32_t c=0; c<m_Width; c++) {
+      uint32_t ci   = c * Multiplier / Divider;
+      uint32_t cii  = (c+1) * Multiplier / Divider;
       int64_t  ciw  = cii * Divider - c * Multiplier;
       int64_t  ciiw = (c+1) * Multiplier - cii * Divider;
       if (cii>=NewWidth) {
@@ -154,11 +156,14 @@ dlImage8* dlImage8::SimpleScale(const float Factor) {
         ci  = NewWidth-1;
         ciw = 0;
       }
+      const size_t Pixel = (size_t)r*m_Width+c;
+      const size_t Row0  = (size_t)ri *NewWidth;
+      const size_t Row1  = (size_t)rii*NewWidth;
       for (short cl=0; cl<3; cl++) {
-        Image64Bit[ri *NewWidth+ci ][cl] += m_Image[r*m_Width+c][cl]*riw *ciw ;
-        Image64Bit[ri *NewWidth+cii][cl] += m_Image[r*m_Width+c][cl]*riw *ciiw;
-        Image64Bit[rii*NewWidth+ci ][cl] += m_Image[r*m_Width+c][cl]*riiw*ciw ;
-        Image64Bit[rii*NewWidth+cii][cl] += m_Image[r*m_Width+c][cl]*riiw*ciiw;
+        Image64Bit[Row0+ci ][cl] += m_Image[Pixel][cl]*riw *ciw ;
+        Image64Bit[Row0+cii][cl] += m_Image[Pixel][cl]*riw *ciiw;
+        Image64Bit[Row1+ci ][cl] += m_Image[Pixel][cl]*riiw*ciw ;
+        Image64Bit[Row1+cii][cl] += m_Image[Pixel][cl]*riiw*ciiw;
       }
     }
   }
@@ -167,11 +172,11 @@ dlImage8* dlImage8::SimpleScale(const float Factor) {
   m_Image = NULL;
 
   m_Image =
-    (uint8_t (*)[4]) CALLOC(NewWidth*NewHeight,sizeof(*m_Image));
+    (uint8_t (*)[4]) CALLOC((size_t)NewWidth*NewHeight,sizeof(*m_Image));
   dlMemoryError(m_Image,__FILE__,__LINE__);
 
   // Fill the image from the Image64Bit.
-  for (uint32_t c=0; c<(uint32_t)NewHeight*NewWidth; c++) {
+  for (uint64_t c=0; c<(uint64_t)NewHeight*NewWidth; c++) {
     for (short cl=0; cl<3; cl++) {
       m_Image[c][cl] = Image64Bit[c][cl]/Normalizer;
     }
@@ -186,6 +191,39 @@ dlImage8* dlImage8::SimpleScale(const float Factor) {
   return this;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// FilteredScale
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlImage8* dlImage8::FilteredScale(const float Factor,
+                                  const short Filter) {
+
+  assert(m_Colors ==3);
+  assert (Factor>0.0);
+
+  if (fabs(Factor-1.0) < 0.01 ) return this;
+
+  const uint32_t NewWidth  = MAX((uint32_t)(m_Width*Factor+0.5),1u);
+  const uint32_t NewHeight = MAX((uint32_t)(m_Height*Factor+0.5),1u);
+
+  uint8_t (*NewImage)[4] =
+    (uint8_t (*)[4]) CALLOC((size_t)NewWidth*NewHeight,sizeof(*m_Image));
+  dlMemoryError(NewImage,__FILE__,__LINE__);
+
+  // The alpha of 0xff stays 0xff, the weights add up to 1.
+  dlResize(&m_Image[0][0],m_Width,m_Height,4*m_Width,Factor,
+           0,0,NewWidth,NewHeight,&NewImage[0][0],4*NewWidth,Filter);
+
+  FREE(m_Image); // free the old image.
+  m_Image  = NewImage;
+  m_Width  = NewWidth;
+  m_Height = NewHeight;
+
+  return this;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // WriteAsPpm
@@ -205,11 +243,11 @@ short dlImage8::WriteAsPpm(const char*  FileName) {
   uint8_t*  PpmRow = (uint8_t *) CALLOC(m_Width,m_Colors);
   dlMemoryError(PpmRow,__FILE__,__LINE__);
 
-  for (uint16_t Row=0; Row<m_Height; Row++) {
-    for (uint16_t Col=0; Col<m_Width; Col++) {
+  for (uint32_t Row=0; Row<m_Height; Row++) {
+    for (uint32_t Col=0; Col<m_Width; Col++) {
       for (short c=0;c<3;c++) {
         // Mind the R<->B swap !
-        PpmRow [Col*m_Colors+c] = m_Image[Row*m_Width+Col][2-c];
+        PpmRow [Col*m_Colors+c] = m_Image[(size_t)Row*m_Width+Col][2-c];
       }
     }
     assert ( m_Width == fwrite(PpmRow,m_Colors,m_Width,OutputFile) );
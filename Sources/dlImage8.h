@@ -41,8 +41,8 @@ public:
 uint8_t (*m_Image)[4];
 
 // Width and height of the image
-uint16_t m_Width;
-uint16_t m_Height;
+uint32_t m_Width;
+uint32_t m_Height;
 
 // Nr of colors in the image (probably always 3 ?)
 short m_Colors;
@@ -59,8 +59,8 @@ short m_ColorSpace;
 dlImage8();
 
 // Just initialize a black image from the given sizes.
-dlImage8(const uint16_t Width,
-         const uint16_t Height,
+dlImage8(const uint32_t Width,
+         const uint32_t Height,
          const short    NrColors = 3);
 
 // Destructor
@@ -73,6 +73,8 @@ dlImage8* Set(const dlImage *Origin);
 // Scale with Facto 0..1
 // Always in place !
 dlImage8* SimpleScale(const float Factor);
+// Scale with Factor (also > 1) through Filter (dlResizeFilter_xxx),
+// separable and over the threads (dlResize). Always in place !
 dlImage8* FilteredScale(const float Factor,
                         const short Filter = dlResizeFilter_Triangle);
 
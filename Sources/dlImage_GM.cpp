@@ -20,11 +20,14 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-#include <QMessageBox>
+#include <cstdlib>
+#include <cstring>
+
 #include "dlImage.h"
 #include "dlConstants.h"
 #include "dlError.h"
-#include "dlSettings.h"
+#include "dlTransformCache.h"
+#include "dlRGBLab.h"
 
 #include <Magick++.h>
 
@@ -36,11 +39,45 @@ using namespace Magick;
 
 #include <lcms2.h>
 
+// Pixels converted to Lab in one go when opening. Small enough to
+// still be in cache for the transform.
+const uint32_t dlImage_DecodeStripPixels = 500000;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ReadRows
+// Rows Top..Top+Rows-1 from the pixel cache as 16 bit RGB.
+// Returns 0 if the cache cannot give them.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static short ReadRows(const Magick::Image& image,
+                      const uint32_t       Top,
+                      const uint32_t       Rows,
+                      uint16_t             (*Target)[3]) {
+
+  const uint32_t Width = image.columns();
+  const PixelPacket* Pixels = image.getConstPixels(0,Top,Width,Rows);
+  if (!Pixels) return 0;
+
+  const int64_t Size = (int64_t)Width*Rows;
+#pragma omp parallel for schedule(static)
+  for (int64_t i = 0; i < Size; i++) {
+    Target[i][0] = ScaleQuantumToShort(Pixels[i].red);
+    Target[i][1] = ScaleQuantumToShort(Pixels[i].green);
+    Target[i][2] = ScaleQuantumToShort(Pixels[i].blue);
+  }
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 // Open Image
 dlImage* dlImage::dlGMOpenImage(const char* FileName,
                                 long& ProfileSize,
                                 uint8_t* &ProfileBuffer,
-                                int& Success) {
+                                int& Success,
+                                const short Tiled) {
 
   Magick::Image image;
   try {
@@ -56,11 +93,9 @@ dlImage* dlImage::dlGMOpenImage(const char* FileName,
     m_Depth = 8;
 
   image.type(TrueColorType);
-  image.magick( "RGB" );
-  image.depth( 16 );
 
-  uint16_t NewWidth = image.columns();
-  uint16_t NewHeight = image.rows();
+  uint32_t NewWidth = image.columns();
+  uint32_t NewHeight = image.rows();
 
   // Get the embedded profile
   Magick::Blob Profile = image.iccColorProfile();
@@ -74,62 +109,117 @@ dlImage* dlImage::dlGMOpenImage(const char* FileName,
 
   memcpy(ProfileBuffer, Profile.data(), ProfileSize);
 
-  cmsHPROFILE InProfile = NULL;
-
-  if (ProfileSize > 0) {
-    InProfile = cmsOpenProfileFromMem(ProfileBuffer, ProfileSize);
-  } else {
-    InProfile = cmsCreate_sRGBProfile();
+  if (ProfileSize == 0) {
     FREE(ProfileBuffer);
   }
-  if (!InProfile) {
-    InProfile = cmsCreate_sRGBProfile();
-  }
 
-  // the next hast to be double for lcms
-  float (*ImageBuffer)[3] =
-    (float (*)[3]) CALLOC(NewWidth*NewHeight,sizeof(*ImageBuffer));
-  dlMemoryError(ImageBuffer,__FILE__,__LINE__);
-
-  image.write(0,0,NewWidth,NewHeight,"RGB",FloatPixel,ImageBuffer);
-
-  FREE(m_Image);
+  FreePixels();
   m_Width  = NewWidth;
   m_Height = NewHeight;
   m_Colors = 3;
   m_ColorSpace = dlSpace_Lab;
-  m_Image = (uint16_t (*)[3]) CALLOC(m_Width*m_Height,sizeof(*m_Image));
-  dlMemoryError(m_Image,__FILE__,__LINE__);
-
-  cmsHPROFILE OutProfile = cmsCreateLab4Profile(NULL);
 
+  // sRGB if there is no (usable) embedded profile.
   cmsHTRANSFORM Transform;
-  Transform = cmsCreateTransform(InProfile,
-                                 TYPE_RGB_FLT,
-                                 OutProfile,
-                                 TYPE_Lab_16,
-                                 INTENT_PERCEPTUAL,
-                                 cmsFLAGS_BLACKPOINTCOMPENSATION);
-
-
-  int32_t Size = m_Width*m_Height;
-  int32_t Step = 100000;
-#pragma omp parallel for schedule(static)
-  for (int32_t i = 0; i < Size; i+=Step) {
-    int32_t Length = (i+Step)<Size ? Step : Size - i;
-    float* Buffer = &ImageBuffer[i][0];
-    uint16_t* Image = &m_Image[i][0];
-    cmsDoTransform(Transform,
-                   Buffer,
-                   Image,
-                   Length);
+  Transform = dlTransformCache::Get(ProfileBuffer,ProfileSize,TYPE_RGB_16,
+                                    NULL,0,TYPE_Lab_16,
+                                    INTENT_PERCEPTUAL,
+                                    cmsFLAGS_BLACKPOINTCOMPENSATION);
+  if (!Transform) {
+    Success = 0;
+    return this;
   }
 
-  cmsDeleteTransform(Transform);
-  cmsCloseProfile(InProfile);
-  cmsCloseProfile(OutProfile);
+  // Computed instead if the profile is one of the built in spaces.
+  const dlRGBLab* Analytic = dlRGBLab::Get(ProfileBuffer,ProfileSize);
+
+  if (Tiled) {
+    // One row of tiles at a time, so only a strip is read out of
+    // the pixel cache. Black becomes the fill, the tiles that are
+    // nothing but that are not kept.
+    memset(m_TileFill,0,sizeof(m_TileFill));
+    if (Analytic) {
+      Analytic->ToLab(&m_TileFill,1);
+    } else {
+      cmsDoTransform(Transform,m_TileFill,m_TileFill,1);
+    }
+
+    const uint32_t TilesX = NrTilesX();
+    const uint32_t TilesY = NrTilesY();
+    m_Tiles = (uint16_t (**)[3])
+      CALLOC((size_t)TilesX*TilesY,sizeof(*m_Tiles));
+    dlMemoryError(m_Tiles,__FILE__,__LINE__);
+
+    uint16_t (*StripBuffer)[3] = (uint16_t (*)[3])
+      CALLOC((size_t)m_Width*dlImage_TileSize,sizeof(*StripBuffer));
+    dlMemoryError(StripBuffer,__FILE__,__LINE__);
+
+    for (uint32_t TileY = 0; TileY < TilesY && Success; TileY++) {
+      const uint32_t Top    = TileY*dlImage_TileSize;
+      const uint32_t Height = MIN(dlImage_TileSize,m_Height-Top);
+      if (!ReadRows(image,Top,Height,StripBuffer)) {
+        Success = 0;
+        break;
+      }
+#pragma omp parallel for schedule(dynamic)
+      for (uint32_t TileX = 0; TileX < TilesX; TileX++) {
+        const uint32_t Left  = TileX*dlImage_TileSize;
+        const uint32_t Width = MIN(dlImage_TileSize,m_Width-Left);
+        uint16_t (*Pixels)[3] = Tile(TileX,TileY);
+        uint16_t (*Source)[3] = StripBuffer + Left;
+        if (Analytic) {
+          for (uint32_t Row = 0; Row < Height; Row++) {
+            uint16_t (*Target)[3] = Pixels + Row*dlImage_TileSize;
+            memcpy(Target,Source+(size_t)Row*m_Width,Width*sizeof(*Target));
+            Analytic->ToLab(Target,Width);
+          }
+        } else {
+          // The rows of the tile straight out of the strip.
+          dlTransformCache::RunLines(Transform,Source,Pixels,Width,Height,
+                                     m_Width*sizeof(*Source),
+                                     dlImage_TileSize*sizeof(*Pixels));
+        }
+        if (IsFill(Pixels,dlImage_TilePixels,m_TileFill)) {
+          FREE(m_Tiles[(size_t)TileY*TilesX+TileX]);
+        }
+      }
+    }
+
+    FREE(StripBuffer);
+  } else {
+    // 16 bit RGB straight from the pixel cache into m_Image, and
+    // converted to Lab in place, a strip at a time.
+    m_Image = (uint16_t (*)[3])
+      CALLOC((size_t)m_Width*m_Height,sizeof(*m_Image));
+    dlMemoryError(m_Image,__FILE__,__LINE__);
+
+    const uint32_t StripHeight =
+      MAX(1,MIN(m_Height,dlImage_DecodeStripPixels/MAX(m_Width,1)));
+    for (uint32_t Top = 0; Top < m_Height; Top += StripHeight) {
+      const uint32_t Height = MIN(StripHeight,m_Height-Top);
+      uint16_t (*Strip)[3] = m_Image + (size_t)Top*m_Width;
+      if (!ReadRows(image,Top,Height,Strip)) {
+        Success = 0;
+        break;
+      }
+      int64_t Size = (int64_t)m_Width*Height;
+      if (Analytic) {
+        int32_t Step = dlTransformCache::ChunkPixels(Size);
+#pragma omp parallel for schedule(dynamic)
+        for (int64_t i = 0; i < Size; i+=Step) {
+          int32_t Length = (i+Step)<Size ? Step : Size - i;
+          Analytic->ToLab(Strip+i,Length);
+        }
+      } else {
+        dlTransformCache::Run(Transform,Strip,Strip,Size);
+      }
+    }
+  }
 
-  FREE(ImageBuffer);
+  if (!Success) {
+    dlLogError(dlError_FileFormat,"Cannot read the pixels of '%s'",FileName);
+    FreePixels();
+  }
 
   return this;
 }
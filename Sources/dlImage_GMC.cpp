@@ -38,6 +38,9 @@ dlImage* dlImage::dlGMCWriteImage(const char* FileName,
                                   const uint8_t* ProfileBuffer,
                                   const long ProfileSize) {
 
+  // Tiles are handed over one by one.
+  if (!IsTiled()) ToInterleaved();
+
   long unsigned int Width  = m_Width;
   long unsigned int Height = m_Height;
 
@@ -51,7 +54,36 @@ dlImage* dlImage::dlGMCWriteImage(const char* FileName,
   MagickSetImageType(mw,TrueColorType);
   MagickSetImageOption(mw, "tiff", "alpha", "associated");
 
-  MagickSetImagePixels(mw,0,0,Width,Height,"RGB",ShortPixel,(unsigned char*) m_Image);
+  if (IsTiled()) {
+    // Edge tiles are packed to their width, absent ones are the fill.
+    uint16_t (*Buffer)[3] =
+      (uint16_t (*)[3]) CALLOC(dlImage_TilePixels,sizeof(*Buffer));
+    dlMemoryError(Buffer,__FILE__,__LINE__);
+    for (uint32_t TileY=0; TileY<NrTilesY(); TileY++) {
+      for (uint32_t TileX=0; TileX<NrTilesX(); TileX++) {
+        const uint32_t Left = TileX*dlImage_TileSize;
+        const uint32_t Top  = TileY*dlImage_TileSize;
+        const uint32_t W    = MIN(dlImage_TileSize,m_Width-Left);
+        const uint32_t H    = MIN(dlImage_TileSize,m_Height-Top);
+        const uint16_t (*Pixels)[3] = m_Tiles[(size_t)TileY*NrTilesX()+TileX];
+        for (uint32_t Row=0; Row<H; Row++) {
+          for (uint32_t Col=0; Col<W; Col++) {
+            const uint16_t* Pixel =
+              Pixels ? Pixels[Row*dlImage_TileSize+Col] : m_TileFill;
+            Buffer[Row*W+Col][0] = Pixel[0];
+            Buffer[Row*W+Col][1] = Pixel[1];
+            Buffer[Row*W+Col][2] = Pixel[2];
+          }
+        }
+        MagickSetImagePixels(mw,Left,Top,W,H,"RGB",ShortPixel,
+                             (unsigned char*) Buffer);
+      }
+    }
+    FREE(Buffer);
+  } else {
+    MagickSetImagePixels(mw,0,0,Width,Height,"RGB",ShortPixel,
+                         (unsigned char*) m_Image);
+  }
 
   if (ProfileSize > 0)
     MagickSetImageProfile(mw,"ICC",ProfileBuffer,ProfileSize);
@@ -65,9 +97,9 @@ dlImage* dlImage::dlGMCWriteImage(const char* FileName,
   // Compression
   MagickSetImageCompression(mw, LZWCompression);
 
-  MagickWriteImage(mw, FileName);
+  const unsigned int Written = MagickWriteImage(mw, FileName);
   DestroyMagickWand(mw);
-  return this;
+  return Written ? this : NULL;
 }
 
 
@@ -57,4 +57,5 @@
 {"HistogramCropH"                       ,9         ,0                                                   ,0},
 {"SatCurveMode"                         ,1         ,0                                                   ,1},
 {"SatCurveType"                         ,1         ,0                                                   ,1},
+{"PlanarPipe"                           ,1         ,1                                                   ,0},
 
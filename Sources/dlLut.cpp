@@ -0,0 +1,774 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2008 Jos De Laender
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+#include "dlLut.h"
+#include "dlCurve.h"
+#include "dlError.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define DL_LUT_X86
+  #include <immintrin.h>
+#endif
+
+// Lookup function, selected once from the cpu.
+typedef void (*dlLutFunction)(const uint16_t* Table,
+                              uint16_t*       Values,
+                              const uint32_t  NrPixels);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Scalar. Also does the tails of the vector versions.
+// Values are the interleaved channels, Table the three tables
+// one after the other.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void ApplyScalar(const uint16_t* Table,
+                        uint16_t*       Values,
+                        const uint32_t  NrPixels) {
+  for (uint32_t i=0; i<NrPixels; i++) {
+    Values[3*i]   = Table[          Values[3*i]];
+    Values[3*i+1] = Table[0x10000 + Values[3*i+1]];
+    Values[3*i+2] = Table[0x20000 + Values[3*i+2]];
+  }
+}
+
+#ifdef DL_LUT_X86
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// AVX2
+// 16 pixels (3 vectors of 16 values) per step. The channel of a value
+// only depends on its position, so the table offset per lane is a
+// constant and no deinterleaving is needed.
+// The 32 bit gathers read 2 bytes past the looked up value, hence the
+// padding entry at the end of m_Table.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static void ApplyAVX2(const uint16_t* Table,
+                      uint16_t*       Values,
+                      const uint32_t  NrPixels) {
+
+  __m256i Offset[6];
+  for (short h=0; h<6; h++) {
+    int32_t Lane[8];
+    for (short k=0; k<8; k++) Lane[k] = ((8*h+k)%3)*0x10000;
+    Offset[h] = _mm256_loadu_si256((const __m256i*) Lane);
+  }
+  const __m256i Mask = _mm256_set1_epi32(0xffff);
+
+  const uint32_t NrSteps = NrPixels/16;
+  for (uint32_t s=0; s<NrSteps; s++) {
+    uint16_t* Step = Values + 48*s;
+    for (short j=0; j<3; j++) {
+      __m256i In = _mm256_loadu_si256((const __m256i*) (Step+16*j));
+      __m256i Lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(In));
+      __m256i Hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(In,1));
+      Lo = _mm256_i32gather_epi32((const int*) Table,
+                                  _mm256_add_epi32(Lo,Offset[2*j]),2);
+      Hi = _mm256_i32gather_epi32((const int*) Table,
+                                  _mm256_add_epi32(Hi,Offset[2*j+1]),2);
+      // packus works per 128 bit lane, permute restores the order.
+      __m256i Out = _mm256_packus_epi32(_mm256_and_si256(Lo,Mask),
+                                        _mm256_and_si256(Hi,Mask));
+      Out = _mm256_permute4x64_epi64(Out,0xd8);
+      _mm256_storeu_si256((__m256i*) (Step+16*j),Out);
+    }
+  }
+  ApplyScalar(Table,Values+48*NrSteps,NrPixels-16*NrSteps);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// AVX-512
+// As AVX2, 32 pixels per step.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx512f")))
+static void ApplyAVX512(const uint16_t* Table,
+                        uint16_t*       Values,
+                        const uint32_t  NrPixels) {
+
+  __m512i Offset[6];
+  for (short h=0; h<6; h++) {
+    int32_t Lane[16];
+    for (short k=0; k<16; k++) Lane[k] = ((16*h+k)%3)*0x10000;
+    Offset[h] = _mm512_loadu_si512(Lane);
+  }
+
+  const uint32_t NrSteps = NrPixels/32;
+  for (uint32_t s=0; s<NrSteps; s++) {
+    uint16_t* Step = Values + 96*s;
+    for (short h=0; h<6; h++) {
+      __m512i Index = _mm512_cvtepu16_epi32(
+        _mm256_loadu_si256((const __m256i*) (Step+16*h)));
+      __m512i Out = _mm512_i32gather_epi32(
+        _mm512_add_epi32(Index,Offset[h]),Table,2);
+      // Truncating to 16 bit drops the 2 bytes read too much.
+      _mm256_storeu_si256((__m256i*) (Step+16*h),_mm512_cvtepi32_epi16(Out));
+    }
+  }
+  ApplyScalar(Table,Values+96*NrSteps,NrPixels-32*NrSteps);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Dispatch
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static dlLutFunction SelectFunction(const char** Path) {
+#ifdef DL_LUT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    *Path = "avx512";
+    return ApplyAVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    *Path = "avx2";
+    return ApplyAVX2;
+  }
+#endif
+  *Path = "scalar";
+  return ApplyScalar;
+}
+
+static const char*   LutPath     = NULL;
+static dlLutFunction LutFunction = SelectFunction(&LutPath);
+
+#ifdef DL_LUT_X86
+static const short   HasAVX2     = __builtin_cpu_supports("avx2");
+#endif
+
+const char* dlLutPath() {
+  return LutPath;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Constructor
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlLut::dlLut(const uint16_t* Table0,
+             const uint16_t* Table1,
+             const uint16_t* Table2) {
+
+  // One padding entry for the gathers.
+  m_Table = (uint16_t*) CALLOC(3*0x10000+1,sizeof(*m_Table));
+  dlMemoryError(m_Table,__FILE__,__LINE__);
+
+  const uint16_t* Table[3] = {Table0,Table1,Table2};
+  for (short c=0; c<3; c++) {
+    uint16_t* Target = m_Table + c*0x10000;
+    if (Table[c]) {
+      for (uint32_t i=0; i<0x10000; i++) Target[i] = Table[c][i];
+    } else {
+      for (uint32_t i=0; i<0x10000; i++) Target[i] = i;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Destructor
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlLut::~dlLut() {
+  FREE(m_Table);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Apply
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlLut::Apply(uint16_t (*Pixels)[3],
+                  const uint32_t NrPixels) const {
+  LutFunction(m_Table,&Pixels[0][0],NrPixels);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlSaturate
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlSaturate(uint16_t       Pixel[3],
+                const dlCurve* Curve,
+                const short    Mode,
+                const short    Type) {
+
+// Best solution would be to use the Lab <-> Lch conversion from lcms.
+// This should be faster without sacrificing much quality.
+
+  // neutral value for a* and b* channel
+  const float WPH = 0x8080;
+
+  float ValueA = (float)Pixel[1]-WPH;
+  float ValueB = (float)Pixel[2]-WPH;
+  float Factor = 0.0;
+
+  if (Type == 0) {
+    // Factor by hue
+    float Hue = 0;
+    if (ValueA == 0.0 && ValueB == 0.0) {
+      Hue = 0;   // value for grey pixel
+    } else {
+      Hue = atan2f(ValueB,ValueA);
+    }
+    while (Hue < 0) Hue += 2.*dlPI;
+
+    Factor = Curve->m_Curve[CLIP((int32_t)(Hue/dlPI*WPH))]/(float)0x7fff;
+  } else {
+    // Factor by luminance
+    Factor = Curve->m_Curve[Pixel[0]]/(float)0x7fff;
+  }
+  if (Factor == 1.0) return;
+  Factor *= Factor;
+  float m = 0;
+  if (Mode == 1) {
+    float Col = powf(ValueA * ValueA + ValueB * ValueB, 0.125);
+    Col /= 0xd; // normalizing to 0..1
+
+    if (Factor > 1)
+      // work more on desaturated pixels
+      m = Factor*(1-Col)+Col;
+    else
+      // work more on saturated pixels
+      m = Factor*Col+(1-Col);
+  } else {
+    m = Factor;
+  }
+  Pixel[1] = CLIP((int32_t)(Pixel[1] * m + WPH * (1. - m)));
+  Pixel[2] = CLIP((int32_t)(Pixel[2] * m + WPH * (1. - m)));
+}
+
+#ifdef DL_LUT_X86
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SaturateAVX2
+// 8 pixels per step, both types and modes :
+//   - hue by an odd minimax polynomial for atan on [0,1] (error below
+//     2e-6 rad) after octant reduction, no atan2f,
+//   - the 8th root of a*a+b*b as three square roots, no powf,
+//   - blend towards 0x8080 and CLIP in the registers.
+// A factor of 1 needs no skip, the blend then gives the input back.
+// The 32 bit gathers read 2 bytes past the b of the last pixel, so
+// this stops one pixel before NrPixels. Returns the pixels done.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static uint32_t SaturateAVX2(const float*   FactorTable,
+                             const short    Mode,
+                             const short    Type,
+                             uint16_t       (*Pixels)[3],
+                             const uint32_t NrPixels) {
+
+  const __m256i Index3   = _mm256_setr_epi32(0,3,6,9,12,15,18,21);
+  const __m256i Mask     = _mm256_set1_epi32(0xffff);
+  const __m256i Zero     = _mm256_setzero_si256();
+  const __m256  Sign     = _mm256_set1_ps(-0.0f);
+  const __m256  One      = _mm256_set1_ps(1.0f);
+  const __m256  WPH      = _mm256_set1_ps(0x8080);
+  const __m256  HalfPI   = _mm256_set1_ps((float)(dlPI/2));
+  const __m256  PI       = _mm256_set1_ps((float)dlPI);
+  const __m256  TwoPI    = _mm256_set1_ps((float)(2*dlPI));
+  const __m256  HueScale = _mm256_set1_ps((float)(0x8080/dlPI));
+  const __m256  ColScale = _mm256_set1_ps(1.0f/0xd);
+
+  uint32_t i = 0;
+  for (; i+8 < NrPixels; i+=8) {
+    __m256i L = _mm256_and_si256(Mask,
+      _mm256_i32gather_epi32((const int*) &Pixels[i][0],Index3,2));
+    __m256  RawA = _mm256_cvtepi32_ps(_mm256_and_si256(Mask,
+      _mm256_i32gather_epi32((const int*) &Pixels[i][1],Index3,2)));
+    __m256  RawB = _mm256_cvtepi32_ps(_mm256_and_si256(Mask,
+      _mm256_i32gather_epi32((const int*) &Pixels[i][2],Index3,2)));
+    __m256  ValueA = _mm256_sub_ps(RawA,WPH);
+    __m256  ValueB = _mm256_sub_ps(RawB,WPH);
+
+    __m256 Factor;
+    if (Type == 0) {
+      __m256 AbsA = _mm256_andnot_ps(Sign,ValueA);
+      __m256 AbsB = _mm256_andnot_ps(Sign,ValueB);
+      // Non zero values are at least 1, grey gives 0/1.
+      __m256 Ratio = _mm256_div_ps(_mm256_min_ps(AbsA,AbsB),
+                         _mm256_max_ps(_mm256_max_ps(AbsA,AbsB),One));
+      __m256 Ratio2 = _mm256_mul_ps(Ratio,Ratio);
+      __m256 Hue = _mm256_set1_ps(-0.01172120f);
+      Hue = _mm256_add_ps(_mm256_mul_ps(Hue,Ratio2),_mm256_set1_ps( 0.05265332f));
+      Hue = _mm256_add_ps(_mm256_mul_ps(Hue,Ratio2),_mm256_set1_ps(-0.11643287f));
+      Hue = _mm256_add_ps(_mm256_mul_ps(Hue,Ratio2),_mm256_set1_ps( 0.19354346f));
+      Hue = _mm256_add_ps(_mm256_mul_ps(Hue,Ratio2),_mm256_set1_ps(-0.33262347f));
+      Hue = _mm256_add_ps(_mm256_mul_ps(Hue,Ratio2),_mm256_set1_ps( 0.99997726f));
+      Hue = _mm256_mul_ps(Hue,Ratio);
+      Hue = _mm256_blendv_ps(Hue,_mm256_sub_ps(HalfPI,Hue),
+                             _mm256_cmp_ps(AbsA,AbsB,_CMP_LT_OQ));
+      Hue = _mm256_blendv_ps(Hue,_mm256_sub_ps(PI,Hue),
+                             _mm256_cmp_ps(ValueA,_mm256_setzero_ps(),_CMP_LT_OQ));
+      Hue = _mm256_blendv_ps(Hue,_mm256_sub_ps(TwoPI,Hue),
+                             _mm256_cmp_ps(ValueB,_mm256_setzero_ps(),_CMP_LT_OQ));
+      __m256i Index = _mm256_cvttps_epi32(_mm256_mul_ps(Hue,HueScale));
+      Index = _mm256_min_epi32(_mm256_max_epi32(Index,Zero),Mask);
+      Factor = _mm256_i32gather_ps(FactorTable,Index,4);
+    } else {
+      Factor = _mm256_i32gather_ps(FactorTable,L,4);
+    }
+
+    __m256 m = Factor;
+    if (Mode == 1) {
+      __m256 Col = _mm256_add_ps(_mm256_mul_ps(ValueA,ValueA),
+                                 _mm256_mul_ps(ValueB,ValueB));
+      Col = _mm256_sqrt_ps(_mm256_sqrt_ps(_mm256_sqrt_ps(Col)));
+      Col = _mm256_mul_ps(Col,ColScale); // normalizing to 0..1
+      __m256 InvCol = _mm256_sub_ps(One,Col);
+      // work more on desaturated pixels
+      __m256 Up   = _mm256_add_ps(_mm256_mul_ps(Factor,InvCol),Col);
+      // work more on saturated pixels
+      __m256 Down = _mm256_add_ps(_mm256_mul_ps(Factor,Col),InvCol);
+      m = _mm256_blendv_ps(Down,Up,_mm256_cmp_ps(Factor,One,_CMP_GT_OQ));
+    }
+
+    __m256 Rest = _mm256_mul_ps(WPH,_mm256_sub_ps(One,m));
+    __m256i NewA = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(RawA,m),Rest));
+    __m256i NewB = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(RawB,m),Rest));
+    NewA = _mm256_min_epi32(_mm256_max_epi32(NewA,Zero),Mask);
+    NewB = _mm256_min_epi32(_mm256_max_epi32(NewB,Zero),Mask);
+
+    int32_t OutA[8];
+    int32_t OutB[8];
+    _mm256_storeu_si256((__m256i*) OutA,NewA);
+    _mm256_storeu_si256((__m256i*) OutB,NewB);
+    for (short k=0; k<8; k++) {
+      Pixels[i+k][1] = OutA[k];
+      Pixels[i+k][2] = OutB[k];
+    }
+  }
+  return i;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlSaturationLut
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlSaturationLut::dlSaturationLut() {
+  m_Valid        = 0;
+  m_Mode         = 0;
+  m_Type         = 0;
+
+  // Independent of the curve, so done once.
+  for (int i=0; i<=dlSaturationLut_AtanSize; i++) {
+    m_Atan[i] = atan((double)i/dlSaturationLut_AtanSize);
+  }
+  for (int i=0; i<=dlSaturationLut_ChromaSize; i++) {
+    m_Col[i] = pow((double)i,0.25)/0xd; // normalizing to 0..1
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlSaturationLut::Update
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlSaturationLut::Update(const dlCurve* Curve,
+                              const short    Mode,
+                              const short    Type) {
+
+  if (m_Valid && Mode == m_Mode && Type == m_Type &&
+      !memcmp(m_Curve,Curve->m_Curve,sizeof(m_Curve))) {
+    return 0;
+  }
+
+  m_Mode = Mode;
+  m_Type = Type;
+  memcpy(m_Curve,Curve->m_Curve,sizeof(m_Curve));
+  for (uint32_t i=0; i<0x10000; i++) {
+    // The squared factor, exactly 1 for a neutral curve value.
+    float Factor = m_Curve[i]/(float)0x7fff;
+    m_Factor[i] = Factor*Factor;
+  }
+  m_Valid = 1;
+#ifdef DEBUG_SATURATIONLUT
+  TRACEMAIN("Saturation tables rebuilt, max deviation %d.",
+            MaxDeviation(Curve));
+#else
+  // 1024 a,b pairs (times 16 L by luminance), well below a millisecond.
+  TRACEMAIN("Saturation tables rebuilt, max deviation %d (coarse).",
+            MaxDeviation(Curve,0x800));
+#endif
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlSaturationLut::MaxDeviation
+//
+// Against dlSaturate on a grid over a and b (and L when by luminance),
+// through the block Apply as used.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+int32_t dlSaturationLut::MaxDeviation(const dlCurve* Curve,
+                                      const uint32_t Step) const {
+
+  const short Mode = m_Mode;
+  const short Type = m_Type;
+  int32_t Deviation = 0;
+  const uint32_t LStep = (Type == 0) ? 0x10000 : 0x1000;
+  const uint32_t Grid  = MAX(Step,0x100);
+  const uint32_t NrB   = 0x10000/Grid;
+#pragma omp parallel for schedule(static) reduction(max:Deviation)
+  for (uint32_t a=0; a<0x10000; a+=Grid) {
+    uint16_t Reference[0x100][3];
+    uint16_t Tabled[0x100][3];
+    for (uint32_t L=0; L<0x10000; L+=LStep) {
+      for (uint32_t b=0; b<NrB; b++) {
+        Reference[b][0] = Tabled[b][0] = L;
+        Reference[b][1] = Tabled[b][1] = a;
+        Reference[b][2] = Tabled[b][2] = b*Grid;
+        dlSaturate(Reference[b],Curve,Mode,Type);
+      }
+      Apply(Tabled,NrB);
+      for (uint32_t b=0; b<NrB; b++) {
+        for (short c=1; c<3; c++) {
+          Deviation = MAX(Deviation,ABS(Reference[b][c]-Tabled[b][c]));
+        }
+      }
+    }
+  }
+  return Deviation;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlSaturationLut::Apply on a block
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlSaturationLut::Apply(uint16_t (*Pixels)[3],
+                            const uint32_t NrPixels) const {
+  uint32_t Done = 0;
+#ifdef DL_LUT_X86
+  if (HasAVX2) Done = SaturateAVX2(m_Factor,m_Mode,m_Type,Pixels,NrPixels);
+#endif
+  for (uint32_t i=Done; i<NrPixels; i++) Apply(Pixels[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DisplayScalar
+// Tetrahedral on the nodes of dlDisplayLut. With the fractions sorted
+// f1 >= f2 >= f3, the corners run from the base node over the axis of
+// f1, then also the axis of f2, to the far node. Ties go to the first
+// channel, so each pixel picks exactly one tetrahedron.
+// Also does the tail of the vector version.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void DisplayScalar(const int32_t* Nodes,
+                          uint16_t       (*Pixels)[3],
+                          const uint32_t NrPixels) {
+
+  const int32_t N         = dlDisplayLut_GridSize;
+  const float   Scale     = (float)(N-1)/0xffff;
+  const int32_t Stride[3] = {4*N*N,4*N,4};
+  const int32_t Far       = Stride[0]+Stride[1]+Stride[2];
+
+  for (uint32_t i=0; i<NrPixels; i++) {
+    int32_t Base = 0;
+    float   Frac[3];
+    for (short c=0; c<3; c++) {
+      const float   Position = Pixels[i][c]*Scale;
+      const int32_t Index    = MIN((int32_t)Position,N-2);
+      Frac[c] = Position-Index;
+      Base   += Index*Stride[c];
+    }
+    short Largest  = 0;
+    short Smallest = 0;
+    for (short c=1; c<3; c++) {
+      if (Frac[c] >  Frac[Largest])  Largest  = c;
+      if (Frac[c] <= Frac[Smallest]) Smallest = c;
+    }
+    const short Middle = 3-Largest-Smallest;
+
+    const int32_t* V0 = Nodes+Base;
+    const int32_t* V1 = V0+Stride[Largest];
+    const int32_t* V3 = V0+Far;
+    const int32_t* V2 = V3-Stride[Smallest];
+    for (short c=0; c<3; c++) {
+      const float Value = V0[c] + Frac[Largest]*(V1[c]-V0[c])
+                                + Frac[Middle]*(V2[c]-V1[c])
+                                + Frac[Smallest]*(V3[c]-V2[c]);
+      Pixels[i][c] = (uint16_t)(Value+0.5f);
+    }
+  }
+}
+
+#ifdef DL_LUT_X86
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DisplayAVX2
+// As DisplayScalar, 8 pixels per step. The tetrahedron is chosen with
+// compares and blends, the 4 corners are 12 gathers from the nodes.
+// The 32 bit gathers of the pixels read 2 bytes past the b of the last
+// pixel, so this stops one pixel before NrPixels. Returns the pixels
+// done.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static uint32_t DisplayAVX2(const int32_t* Nodes,
+                            uint16_t       (*Pixels)[3],
+                            const uint32_t NrPixels) {
+
+  const int32_t N = dlDisplayLut_GridSize;
+  const __m256i Index3 = _mm256_setr_epi32(0,3,6,9,12,15,18,21);
+  const __m256i Mask   = _mm256_set1_epi32(0xffff);
+  const __m256i Last   = _mm256_set1_epi32(N-2);
+  const __m256  Scale  = _mm256_set1_ps((float)(N-1)/0xffff);
+  const __m256  Half   = _mm256_set1_ps(0.5f);
+  const __m256i Stride[3] = {_mm256_set1_epi32(4*N*N),
+                             _mm256_set1_epi32(4*N),
+                             _mm256_set1_epi32(4)};
+  const __m256i Far    = _mm256_set1_epi32(4*N*N+4*N+4);
+
+  uint32_t i = 0;
+  for (; i+8 < NrPixels; i+=8) {
+    __m256i Base = _mm256_setzero_si256();
+    __m256  Frac[3];
+    for (short c=0; c<3; c++) {
+      __m256 Position = _mm256_mul_ps(Scale,_mm256_cvtepi32_ps(
+        _mm256_and_si256(Mask,
+          _mm256_i32gather_epi32((const int*) &Pixels[i][c],Index3,2))));
+      __m256i Index = _mm256_min_epi32(_mm256_cvttps_epi32(Position),Last);
+      Frac[c] = _mm256_sub_ps(Position,_mm256_cvtepi32_ps(Index));
+      Base = _mm256_add_epi32(Base,_mm256_mullo_epi32(Index,Stride[c]));
+    }
+
+    // Same tie rules as DisplayScalar.
+    __m256i GE01 = _mm256_castps_si256(
+      _mm256_cmp_ps(Frac[0],Frac[1],_CMP_GE_OQ));
+    __m256i GE02 = _mm256_castps_si256(
+      _mm256_cmp_ps(Frac[0],Frac[2],_CMP_GE_OQ));
+    __m256i GE12 = _mm256_castps_si256(
+      _mm256_cmp_ps(Frac[1],Frac[2],_CMP_GE_OQ));
+    __m256i LargestStride = _mm256_blendv_epi8(
+      _mm256_blendv_epi8(Stride[2],Stride[1],GE12),
+      Stride[0],_mm256_and_si256(GE01,GE02));
+    __m256i SmallestStride = _mm256_blendv_epi8(
+      _mm256_blendv_epi8(Stride[0],Stride[1],GE01),
+      Stride[2],_mm256_and_si256(GE02,GE12));
+
+    __m256 Max01 = _mm256_max_ps(Frac[0],Frac[1]);
+    __m256 Min01 = _mm256_min_ps(Frac[0],Frac[1]);
+    __m256 F1 = _mm256_max_ps(Max01,Frac[2]);
+    __m256 F2 = _mm256_max_ps(Min01,_mm256_min_ps(Max01,Frac[2]));
+    __m256 F3 = _mm256_min_ps(Min01,Frac[2]);
+
+    __m256i Corner1 = _mm256_add_epi32(Base,LargestStride);
+    __m256i Corner3 = _mm256_add_epi32(Base,Far);
+    __m256i Corner2 = _mm256_sub_epi32(Corner3,SmallestStride);
+
+    int32_t Out[3][8];
+    for (short c=0; c<3; c++) {
+      __m256 V0 = _mm256_cvtepi32_ps(
+        _mm256_i32gather_epi32((const int*) Nodes+c,Base,4));
+      __m256 V1 = _mm256_cvtepi32_ps(
+        _mm256_i32gather_epi32((const int*) Nodes+c,Corner1,4));
+      __m256 V2 = _mm256_cvtepi32_ps(
+        _mm256_i32gather_epi32((const int*) Nodes+c,Corner2,4));
+      __m256 V3 = _mm256_cvtepi32_ps(
+        _mm256_i32gather_epi32((const int*) Nodes+c,Corner3,4));
+      __m256 Value = _mm256_add_ps(V0,_mm256_mul_ps(F1,_mm256_sub_ps(V1,V0)));
+      Value = _mm256_add_ps(Value,_mm256_mul_ps(F2,_mm256_sub_ps(V2,V1)));
+      Value = _mm256_add_ps(Value,_mm256_mul_ps(F3,_mm256_sub_ps(V3,V2)));
+      _mm256_storeu_si256((__m256i*) Out[c],
+                          _mm256_cvttps_epi32(_mm256_add_ps(Value,Half)));
+    }
+    for (short k=0; k<8; k++) {
+      Pixels[i+k][0] = Out[0][k];
+      Pixels[i+k][1] = Out[1][k];
+      Pixels[i+k][2] = Out[2][k];
+    }
+  }
+  return i;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlDisplayLut
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlDisplayLut::dlDisplayLut() {
+  const int32_t N = dlDisplayLut_GridSize;
+  m_Transform = NULL;
+  m_Nodes = (int32_t*) CALLOC(4*N*N*N,sizeof(*m_Nodes));
+  dlMemoryError(m_Nodes,__FILE__,__LINE__);
+}
+
+dlDisplayLut::~dlDisplayLut() {
+  FREE(m_Nodes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlDisplayLut::Update
+// The nodes are sampled in one transform call, rounded to the nearest
+// 16 bit value.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlDisplayLut::Update(cmsHTRANSFORM Transform) {
+
+  if (!Transform || Transform == m_Transform) return 0;
+
+  const int32_t N       = dlDisplayLut_GridSize;
+  const int32_t NrNodes = N*N*N;
+  uint16_t (*Grid)[3] = (uint16_t (*)[3]) CALLOC(NrNodes,sizeof(*Grid));
+  dlMemoryError(Grid,__FILE__,__LINE__);
+
+  int32_t Node = 0;
+  for (int32_t L=0; L<N; L++) {
+    for (int32_t a=0; a<N; a++) {
+      for (int32_t b=0; b<N; b++) {
+        Grid[Node][0] = (L*0xffff+(N-1)/2)/(N-1);
+        Grid[Node][1] = (a*0xffff+(N-1)/2)/(N-1);
+        Grid[Node][2] = (b*0xffff+(N-1)/2)/(N-1);
+        Node++;
+      }
+    }
+  }
+  cmsDoTransform(Transform,Grid,Grid,NrNodes);
+  for (Node=0; Node<NrNodes; Node++) {
+    for (short c=0; c<3; c++) m_Nodes[4*Node+c] = Grid[Node][c];
+    m_Nodes[4*Node+3] = 0;
+  }
+  FREE(Grid);
+
+  m_Transform = Transform;
+  TRACEMAIN("Display table sampled, %d nodes.",NrNodes);
+
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlDisplayLut::Apply
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlDisplayLut::Apply(uint16_t (*Pixels)[3],
+                         const uint32_t NrPixels) const {
+  assert(m_Transform);
+  uint32_t Done = 0;
+#ifdef DL_LUT_X86
+  if (HasAVX2) Done = DisplayAVX2(m_Nodes,Pixels,NrPixels);
+#endif
+  DisplayScalar(m_Nodes,Pixels+Done,NrPixels-Done);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlDisplayLut::Apply (to the screen)
+// Per block of pixels, small enough for the stack and the first level
+// cache : gathered with the View LAB isolation into the block, the table
+// on it, then packed into RGB32.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlDisplayLut::Apply(const uint16_t* const Lab[3],
+                         const int32_t  Step,
+                         const short    ViewLAB,
+                         uint32_t*      RGB32,
+                         const uint32_t NrPixels) const {
+
+  const uint32_t BlockSize = 256;
+  uint16_t Block[BlockSize][3];
+
+  short Source = -1;
+  switch(ViewLAB) {
+    case dlViewLAB_L: Source = 0; break;
+    case dlViewLAB_A: Source = 1; break;
+    case dlViewLAB_B: Source = 2; break;
+    default: break;
+  }
+
+  for (uint32_t Start=0; Start<NrPixels; Start+=BlockSize) {
+    const uint32_t Length = MIN(BlockSize,NrPixels-Start);
+    const size_t   Offset = (size_t)Start*Step;
+
+    if (Source >= 0) {
+      const uint16_t* In = Lab[Source]+Offset;
+      for (uint32_t i=0; i<Length; i++) {
+        Block[i][0] = In[(size_t)i*Step];
+        Block[i][1] = 0x8080;
+        Block[i][2] = 0x8080;
+      }
+    } else if (Step == 3) {
+      memcpy(Block,Lab[0]+Offset,Length*sizeof(*Block));
+    } else {
+      const uint16_t* In[3] = {Lab[0]+Offset,Lab[1]+Offset,Lab[2]+Offset};
+      for (uint32_t i=0; i<Length; i++) {
+        for (short c=0; c<3; c++) Block[i][c] = In[c][(size_t)i*Step];
+      }
+    }
+
+    Apply(Block,Length);
+
+    uint32_t* Out = RGB32+Start;
+    for (uint32_t i=0; i<Length; i++) Out[i] = dlToRGB32(Block[i]);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
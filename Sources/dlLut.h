@@ -0,0 +1,266 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2008 Jos De Laender
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+#ifndef DLLUT_H
+#define DLLUT_H
+
+#include <cmath>
+
+#include <lcms2.h>
+
+#include "dlDefines.h"
+#include "dlConstants.h"
+
+class dlCurve;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlLut
+// Table lookup on interleaved 3 channel 16 bit pixels, the core
+// operation of the curves.
+//
+// The three 0x10000 entry tables are copied into one buffer so that a
+// single gather (AVX2 or AVX-512, chosen at runtime from the cpu) looks
+// up pixels of all channels at once. Without those a scalar loop is
+// used. All paths give identical results.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+class dlLut {
+public:
+
+// Tables for channel 0,1,2. A NULL table leaves that channel as is.
+dlLut(const uint16_t* Table0,
+      const uint16_t* Table1,
+      const uint16_t* Table2);
+
+// Destructor
+~dlLut();
+
+// In place on NrPixels pixels. Single threaded, callers split the
+// image over the threads.
+void Apply(uint16_t (*Pixels)[3],
+           const uint32_t NrPixels) const;
+
+private:
+uint16_t* m_Table;
+};
+
+// Name of the lookup path in use ("avx512", "avx2" or "scalar").
+const char* dlLutPath();
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlSaturate
+// The saturation curve on one Lab pixel, straight float math with
+// atan2f and powf. Reference for dlSaturationLut.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlSaturate(uint16_t       Pixel[3],
+                const dlCurve* Curve,
+                const short    Mode,
+                const short    Type);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlSaturationLut
+// The saturation curve from tables instead of atan2f and powf :
+//   - the squared factor per curve index (by hue) or per L,
+//   - atan over [0,1] for the hue, after reduction to one octant,
+//   - the normalized 8th root of a*a+b*b over the chroma.
+// The two last ones are interpolated. The vector path only uses the
+// first one.
+// Update only rebuilds when curve, mode or type changed. The largest
+// deviation from dlSaturate is then traced (TRACEMAIN), from a coarse
+// grid, or from the full one when DEBUG_SATURATIONLUT is defined.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Entries of the atan table over [0,1].
+const int dlSaturationLut_AtanSize = 4096;
+// Entries of the chroma table, sqrt(2)*0x8080 and some margin.
+const int dlSaturationLut_ChromaSize = 0xb800;
+
+class dlSaturationLut {
+public:
+
+dlSaturationLut();
+
+// Rebuilds the tables if needed. Returns 1 if rebuilt.
+short Update(const dlCurve* Curve,
+             const short    Mode,
+             const short    Type);
+
+// In place on one Lab pixel.
+inline void Apply(uint16_t Pixel[3]) const;
+
+// In place on NrPixels Lab pixels. Vectorized (AVX2) when the cpu
+// allows, with a polynomial atan and square roots instead of the
+// atan and chroma tables.
+void Apply(uint16_t (*Pixels)[3],
+           const uint32_t NrPixels) const;
+
+// Largest difference of the tables to dlSaturate with Curve, in 16 bit
+// a or b units, on a grid of Step (a power of 2, at least 0x100) over
+// a and b. The full grid is for testing only.
+int32_t MaxDeviation(const dlCurve* Curve,
+                     const uint32_t Step = 0x100) const;
+
+private:
+short    m_Valid;
+short    m_Mode;
+short    m_Type;
+uint16_t m_Curve[0x10000];
+float    m_Factor[0x10000];
+float    m_Atan[dlSaturationLut_AtanSize+1];
+float    m_Col[dlSaturationLut_ChromaSize+1];
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlDisplayLut
+// Lab to the display for the preview, from a 3D table instead of lcms
+// on every refresh.
+//
+// The table holds the transform sampled once on a grid over the full
+// 16 bit Lab cube, so the preview is exact on the nodes and
+// interpolated in between. The interpolation is tetrahedral : per
+// pixel the cube around it is split in 6 tetrahedra along the sorted
+// fractions and only the 4 corners of the one it is in are used.
+// 8 pixels per step with AVX2 when the cpu allows, scalar otherwise.
+// Update only samples again when given another transform, which
+// happens when the display profile changes.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Nodes per axis.
+const int dlDisplayLut_GridSize = 33;
+
+class dlDisplayLut {
+public:
+
+dlDisplayLut();
+
+// Destructor
+~dlDisplayLut();
+
+// Samples Transform (TYPE_Lab_16 to TYPE_RGB_16) if needed.
+// Returns 1 if sampled.
+short Update(cmsHTRANSFORM Transform);
+
+// Lab to RGB in place on NrPixels pixels. Single threaded, callers
+// split the image over the threads.
+void Apply(uint16_t (*Pixels)[3],
+           const uint32_t NrPixels) const;
+
+// Lab to the screen on NrPixels pixels, out of place and in one pass :
+// the View LAB (dlViewLAB_xxx) isolation, the table, and the result as
+// 8 bit 0xffRRGGBB (the pixels of a QImage::Format_RGB32) into RGB32.
+// The channels are read from Lab[0..2], values Step apart : 3 for the
+// interleaved pixels of m_Image (Lab[c] then m_Image[0]+c), 1 for the
+// planes of a planar image.
+void Apply(const uint16_t* const Lab[3],
+           const int32_t  Step,
+           const short    ViewLAB,
+           uint32_t*      RGB32,
+           const uint32_t NrPixels) const;
+
+private:
+cmsHTRANSFORM m_Transform;
+// Per node R,G,B and one padding value : a node is 4 int32_t.
+int32_t*      m_Nodes;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlToRGB32
+// A 16 bit RGB pixel as the 0xffRRGGBB of QImage::Format_RGB32.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+inline uint32_t dlToRGB32(const uint16_t Pixel[3]) {
+  return 0xff000000u | (uint32_t)(Pixel[0]>>8)<<16
+                     | (uint32_t)(Pixel[1]>>8)<<8
+                     | (uint32_t)(Pixel[2]>>8);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlSaturationLut::Apply
+// Same steps as dlSaturate, inline for the pixel loops.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+inline void dlSaturationLut::Apply(uint16_t Pixel[3]) const {
+  // neutral value for a* and b* channel
+  const float WPH = 0x8080;
+
+  const float ValueA = (float)Pixel[1]-WPH;
+  const float ValueB = (float)Pixel[2]-WPH;
+  float Factor = 0.0;
+
+  if (m_Type == 0) {
+    float Hue = 0;   // value for grey pixel
+    const float AbsA = fabsf(ValueA);
+    const float AbsB = fabsf(ValueB);
+    if (AbsA != 0.0 || AbsB != 0.0) {
+      // Octant reduction, atan of Ratio in [0,1].
+      const float Ratio = (AbsA >= AbsB) ? AbsB/AbsA : AbsA/AbsB;
+      const float Position = Ratio*dlSaturationLut_AtanSize;
+      const int   Index = MIN((int)Position,dlSaturationLut_AtanSize-1);
+      const float Frac  = Position-Index;
+      Hue = m_Atan[Index] + Frac*(m_Atan[Index+1]-m_Atan[Index]);
+      if (AbsA < AbsB) Hue = (float)(dlPI/2) - Hue;
+      if (ValueA < 0)  Hue = (float)dlPI - Hue;
+      if (ValueB < 0)  Hue = (float)(2*dlPI) - Hue;
+    }
+    Factor = m_Factor[CLIP((int32_t)(Hue/dlPI*WPH))];
+  } else {
+    Factor = m_Factor[Pixel[0]];
+  }
+  if (Factor == 1.0) return;
+
+  float m = 0;
+  if (m_Mode == 1) {
+    const float Chroma   = sqrtf(ValueA * ValueA + ValueB * ValueB);
+    const int   Index    = MIN((int)Chroma,dlSaturationLut_ChromaSize-1);
+    const float Frac     = Chroma-Index;
+    const float Col = m_Col[Index] + Frac*(m_Col[Index+1]-m_Col[Index]);
+
+    if (Factor > 1)
+      // work more on desaturated pixels
+      m = Factor*(1-Col)+Col;
+    else
+      // work more on saturated pixels
+      m = Factor*Col+(1-Col);
+  } else {
+    m = Factor;
+  }
+  Pixel[1] = CLIP((int32_t)(Pixel[1] * m + WPH * (1. - m)));
+  Pixel[2] = CLIP((int32_t)(Pixel[2] * m + WPH * (1. - m)));
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
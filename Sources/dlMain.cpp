@@ -29,6 +29,9 @@
 #include <cassert>
 
 #include "dlProcessor.h"
+#include "dlPipeWorker.h"
+#include "dlExport.h"
+#include "dlTransformCache.h"
 #include "dlMainWindow.h"
 #include "dlViewWindow.h"
 #include "dlCurveWindow.h"
@@ -37,6 +40,7 @@
 #include "dlSettings.h"
 #include "dlError.h"
 #include "dlCurve.h"
+#include "dlLut.h"
 
 #include <Magick++.h>
 #include <lcms2.h>
@@ -53,6 +57,8 @@ using namespace std;
 ////////////////////////////////////////////////////////////////////////////////
 
 dlProcessor* TheProcessor    = NULL;
+// Runs TheProcessor for the preview, off the gui thread.
+dlPipeWorker* PipeWorker     = NULL;
 
 // L,a,b
 dlCurve*  Curve[4]        = {NULL,NULL,NULL,NULL};
@@ -62,9 +68,13 @@ QStringList CurveKeys, CurveBackupKeys;
 QStringList CurveFileNamesKeys;
 
 cmsHPROFILE PreviewColorProfile = NULL;
+// Lab to the screen for the preview.
+dlDisplayLut* DisplayLut = NULL;
 
-dlImage*  PreviewImage     = NULL;
-dlImage*  HistogramImage   = NULL;
+// The preview, as the worker converted it to the screen.
+QImage*   PreviewScreen    = NULL;
+// Finer part of the image for a view zoomed in beyond the pipe size.
+QImage*   DetailImage      = NULL;
 
 // The main windows of the application.
 dlMainWindow*      MainWindow      = NULL;
@@ -93,8 +103,6 @@ const QString CurveFilePattern =
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-void   RunJob(const QString FileName);
-short  ReadJobFile(const QString FileName);
 void   WriteOut();
 void   UpdatePreviewImage(const dlImage* ForcedImage   = NULL,
                           const short    OnlyHistogram = 0,
@@ -118,24 +126,127 @@ void ReportProgress(const QString Message) {
   if (!MainWindow) return;
   MainWindow->StatusLabel->setText(Message);
   MainWindow->StatusLabel->repaint();
-  // Workaround to keep the GUI responsive
-  // during pipe processing...
-  QApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
+}
+
+// The one of the processor, called from the worker thread as well.
+void PipeProgress(const QString Message) {
+  PipeWorker->ReportProgress(Message);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Copy the settings relevant for the pipe to PipeSettings, by default
+// those of the processor. The curves are the program wide ones.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void UpdateProcessorSettings(dlProcessorSettings* PipeSettings = NULL) {
+  if (!PipeSettings) PipeSettings = &TheProcessor->m_Settings;
+  PipeSettings->InputFileName   = Settings->GetString("InputFileName");
+  PipeSettings->JobMode         = Settings->GetInt("JobMode");
+  PipeSettings->PipeSize        = Settings->GetInt("PipeSize");
+  PipeSettings->CurveL          = Settings->GetInt("CurveL");
+  PipeSettings->CurveLa         = Settings->GetInt("CurveLa");
+  PipeSettings->CurveLb         = Settings->GetInt("CurveLb");
+  PipeSettings->CurveSaturation = Settings->GetInt("CurveSaturation");
+  PipeSettings->SatCurveMode    = Settings->GetInt("SatCurveMode");
+  PipeSettings->SatCurveType    = Settings->GetInt("SatCurveType");
+  PipeSettings->Planar          = Settings->GetInt("PlanarPipe");
+  PipeSettings->Tiled           = 0;
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    PipeSettings->Curves[Channel] = NULL;
+  }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Update
+// Hands the pipe from Phase on to the worker and returns right away.
+// The preview is shown once it is done (PipeFinished). Edits coming in
+// meanwhile stop that run and are merged into the next one.
+// dlProcessorMode_Drag gives a quick preview from the coarse level.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
+void ViewWindowStatusReport(short State);
+
 void Update(short Phase,
-            short SubPhase      = -1,
-            short WithIdentify  = 1,
             short ProcessorMode = dlProcessorMode_Preview) {
   MainWindow->UpdateSettings();
-  TheProcessor->Run(Phase,SubPhase,WithIdentify, ProcessorMode);
-  UpdatePreviewImage();
+  dlProcessorSettings PipeSettings;
+  UpdateProcessorSettings(&PipeSettings);
+  ViewWindowStatusReport(2);
+  PipeWorker->Request(Phase,ProcessorMode,PipeSettings,Curve,
+                      Settings->GetInt("PreviewMode"),
+                      Settings->GetInt("ViewLAB"));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// PipeFinished
+// On the gui thread, when the worker has a new preview.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void PipeFinished() {
+  if (!PreviewScreen) PreviewScreen = new QImage;
+  if (PipeWorker->Take(PreviewScreen)) {
+    // The detail follows, if any.
+    ViewWindow->UpdateDetail(NULL);
+    Settings->SetValue("PipeImageW",PreviewScreen->width());
+    Settings->SetValue("PipeImageH",PreviewScreen->height());
+    UpdatePreviewImage();
+  }
+
+  if (!DetailImage) DetailImage = new QImage;
+  dlPipeRegion Region;
+  if (PipeWorker->TakeDetail(DetailImage,Region) &&
+      Region.PipeSize == Settings->GetInt("PipeSize")) {
+    const double Scale = 1<<(Region.PipeSize-Region.Level);
+    ViewWindow->UpdateDetail(DetailImage,
+                             Region.X/Scale,Region.Y/Scale,
+                             Region.Width/Scale,Region.Height/Scale);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// CB_ViewWindowRegionChanged
+// The view moved or zoomed. Zoomed in beyond the pipe size, the part
+// shown (and a margin for small moves) is also run on the coarsest
+// level of the pyramid that has a pixel per screen pixel.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void CB_ViewWindowRegionChanged() {
+  dlPipeRegion Region;
+  Region.PipeSize = Settings->GetInt("PipeSize");
+  Region.Level    = Region.PipeSize;
+  Region.X        = 0;
+  Region.Y        = 0;
+  Region.Width    = 0;
+  Region.Height   = 0;
+
+  const double Zoom = ViewWindow->m_ZoomFactor;
+  if (PreviewScreen && !PreviewScreen->isNull() &&
+      Region.PipeSize > dlPipeSize_Full && Zoom > 1.0) {
+    double Scale = 1.0;
+    while (Region.Level > dlPipeSize_Full && Scale < Zoom) {
+      Region.Level--;
+      Scale *= 2;
+    }
+    double X,Y,Width,Height;
+    ViewWindow->GetVisibleRegion(X,Y,Width,Height);
+    X      = MAX(0.0,X-Width/8);
+    Y      = MAX(0.0,Y-Height/8);
+    Region.X      = (uint32_t)(X*Scale);
+    Region.Y      = (uint32_t)(Y*Scale);
+    Region.Width  = (uint32_t)(Width*1.25*Scale+1);
+    Region.Height = (uint32_t)(Height*1.25*Scale+1);
+  }
+
+  if (!Region.Width) ViewWindow->UpdateDetail(NULL);
+  PipeWorker->RequestRegion(Region);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -232,13 +343,21 @@ int LabCurvesMain(int Argc, char *Argv[]) {
     }
   }
 
+  // Transforms built by earlier runs.
+  dlTransformCache::SetDirectory(dlTransformCache::DefaultDirectory());
+
   // Instantiate the processor.
-  TheProcessor = new dlProcessor(ReportProgress);
+  TheProcessor = new dlProcessor(PipeProgress);
 
   GuiOptions  = new dlGuiOptions();
 
   // Open and keep open the profile for previewing.
   PreviewColorProfile = cmsCreate_sRGBProfile();
+  DisplayLut = new dlDisplayLut();
+
+  // From now on the pipe of the preview runs on its own thread.
+  PipeWorker = new dlPipeWorker(TheProcessor,DisplayLut,
+                                PipeFinished,ReportProgress);
 
   MainWindow =
     new dlMainWindow(QObject::tr("Lab curves"));
@@ -320,8 +439,8 @@ void CB_Event0() {
 
   // Open file
   int OpenError = 0;
-  uint16_t InputWidth = 0;
-  uint16_t InputHeight = 0;
+  uint32_t InputWidth = 0;
+  uint32_t InputHeight = 0;
   try {
     Magick::Image image;
 
@@ -344,11 +463,12 @@ void CB_Event0() {
     QMessageBox::critical(MainWindow,"Error","Image too small!");
     exit(EXIT_FAILURE);
   }
+  UpdateProcessorSettings();
   if (TheProcessor->Open() == 0) {
     QMessageBox::critical(MainWindow,"Error","Could not open!");
     exit(EXIT_FAILURE);
   }
-  uint16_t LongerSide = InputWidth>InputHeight?InputWidth:InputHeight;
+  uint32_t LongerSide = InputWidth>InputHeight?InputWidth:InputHeight;
   if (LongerSide > 4800) Settings->SetValue("PipeSize", 3);
   else if (LongerSide > 2400) Settings->SetValue("PipeSize", 2);
   else if (LongerSide > 1200) Settings->SetValue("PipeSize", 1);
@@ -486,7 +606,8 @@ void ViewWindowStatusReport(short State) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Determine and update the preview image.
+// Show the preview image and its histogram. PreviewScreen is made by the
+// worker (dlPipeWorker), already converted to the screen.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -494,7 +615,7 @@ void UpdatePreviewImage(const dlImage* ForcedImage   /* = NULL  */,
                         const short    OnlyHistogram /* = false */,
                         const short    ForceRun      /* = 0     */) {
 
-  if (!TheProcessor->m_Image_AfterLab) {
+  if (!PreviewScreen || PreviewScreen->isNull()) {
     ViewWindow->UpdateView(NULL,1);
     // The splash we want to fit always, but not loosing the
     // m_ZoomMode or m_Zoom setting due to that process.
@@ -509,51 +630,29 @@ void UpdatePreviewImage(const dlImage* ForcedImage   /* = NULL  */,
   ViewWindow->StatusReport(1);
   ReportProgress(QObject::tr("Updating preview image"));
 
-  // Create PreviewImage if needed and it's not yet there.
-  if (!PreviewImage && !OnlyHistogram) PreviewImage = new (dlImage);
-
-  if (!HistogramImage) HistogramImage = new (dlImage);
-
-  // Determine first what is the current image.
-  if (!OnlyHistogram) {
-    if (Settings->GetInt("PreviewMode") == dlPreviewMode_Tab)
-      PreviewImage->Set(TheProcessor->m_Image_AfterScale);
-    else
-      PreviewImage->Set(TheProcessor->m_Image_AfterLab);
-  }
-
-  // View LAB
-  if (Settings->GetInt("ViewLAB")) {
-    ReportProgress(QObject::tr("View LAB"));
-    PreviewImage->ViewLAB(Settings->GetInt("ViewLAB"));
-  }
-
-  ReportProgress(QObject::tr("Converting to screen space"));
-
-  PreviewImage->lcmsLabToRGBSimple();
-
+  // Counted on the preview itself, of the crop only.
   ReportProgress(QObject::tr("Updating Histogram"));
-  HistogramImage->Set(PreviewImage);
 
-  uint16_t Width = 0;
-  uint16_t Height = 0;
-  uint16_t TempCropX = 0;
-  uint16_t TempCropY = 0;
-  uint16_t TempCropW = 0;
-  uint16_t TempCropH = 0;
+  uint32_t Width = 0;
+  uint32_t Height = 0;
+  uint32_t TempCropX = 0;
+  uint32_t TempCropY = 0;
+  uint32_t TempCropW = 0;
+  uint32_t TempCropH = 0;
 
-  HistogramWindow->UpdateView(HistogramImage);
   // In case of histogram update only, we're done.
   if (OnlyHistogram) {
+    HistogramWindow->UpdateView(PreviewScreen);
     Settings->SetValue("PipeIsRunning",0);
     ViewWindow->StatusReport(0);
     return;
   }
 
+  QRect HistogramCrop;
   if (Settings->GetInt("HistogramCrop")) {
     short TmpScaled = Settings->GetInt("PipeSize");
-    Width = HistogramImage->m_Width;
-    Height = HistogramImage->m_Height;
+    Width = PreviewScreen->width();
+    Height = PreviewScreen->height();
     TempCropX = Settings->GetInt("HistogramCropX")>>TmpScaled;
     TempCropY = Settings->GetInt("HistogramCropY")>>TmpScaled;
     TempCropW = Settings->GetInt("HistogramCropW")>>TmpScaled;
@@ -569,12 +668,12 @@ void UpdatePreviewImage(const dlImage* ForcedImage   /* = NULL  */,
       Settings->SetValue("HistogramCropH",0);
       Settings->SetValue("HistogramCrop",0);
     } else {
-      HistogramImage->Crop(TempCropX, TempCropY, TempCropW, TempCropH);
+      HistogramCrop = QRect(TempCropX, TempCropY, TempCropW, TempCropH);
     }
   }
-  HistogramWindow->UpdateView(HistogramImage);
+  HistogramWindow->UpdateView(PreviewScreen,HistogramCrop);
 
-  ViewWindow->UpdateView(PreviewImage);
+  ViewWindow->UpdateView(PreviewScreen);
   ViewWindow->StatusReport(0);
   ReportProgress(QObject::tr("Ready"));
 }
@@ -583,58 +682,23 @@ void UpdatePreviewImage(const dlImage* ForcedImage   /* = NULL  */,
 //
 // WriteOut
 // Write out in one of the output formats (after applying output profile).
+// The full size image is run again from the input file, in strips.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
 void WriteOut() {
-  ReportProgress(QObject::tr("Converting to output profile"));
-  dlImage* OutImage = TheProcessor->m_Image_AfterLab;
-
-  cmsHPROFILE InProfile = cmsCreateLab4Profile(NULL);
-
-  cmsHPROFILE OutProfile = NULL;
-  if (TheProcessor->m_ProfileSize > 0) {
-    OutProfile = cmsOpenProfileFromMem(
-      TheProcessor->m_ProfileBuffer,
-      TheProcessor->m_ProfileSize);
-  } else {
-    OutProfile = cmsCreate_sRGBProfile();
+  // The full size image of the gui is not needed any more.
+  if (TheProcessor->m_Image_AfterScale != TheProcessor->m_Image_AfterOpen) {
+    delete TheProcessor->m_Image_AfterOpen;
+    TheProcessor->m_Image_AfterOpen = NULL;
   }
 
-  if (!OutProfile) {
-    OutProfile = cmsCreate_sRGBProfile();
+  dlExport Export(TheProcessor);
+  if (Export.Run(Settings->GetString("InputFileName"),
+                 Settings->GetString("OutputFileName"))) {
+    QMessageBox::critical(MainWindow,"Export error",dlErrorMessage);
   }
 
-  cmsHTRANSFORM Transform;
-  Transform = cmsCreateTransform(InProfile,
-                                 TYPE_Lab_16,
-                                 OutProfile,
-                                 TYPE_RGB_16,
-                                 INTENT_PERCEPTUAL,
-                                 cmsFLAGS_BLACKPOINTCOMPENSATION);
-
-  int32_t Size = OutImage->m_Width*OutImage->m_Height;
-  int32_t Step = 100000;
-#pragma omp parallel for schedule(static)
-  for (int32_t i = 0; i < Size; i+=Step) {
-    int32_t Length = (i+Step)<Size ? Step : Size - i;
-    uint16_t* Image = &(OutImage->m_Image[i][0]);
-    cmsDoTransform(Transform,Image,Image,Length);
-  }
-
-  cmsDeleteTransform(Transform);
-  cmsCloseProfile(InProfile);
-  cmsCloseProfile(OutProfile);
-
-  ReportProgress(QObject::tr("Writing output"));
-
-  OutImage->dlGMCWriteImage(
-      Settings->GetString("OutputFileName").toAscii().data(),
-      TheProcessor->m_ProfileBuffer,
-      TheProcessor->m_ProfileSize);
-
-  delete OutImage;
-
   ReportProgress(QObject::tr("Ready"));
 }
 
@@ -656,10 +720,9 @@ void UpdateSettings() {
 ////////////////////////////////////////////////////////////////////////////////
 
 void CB_MenuFileSaveOutput(const short) {
-  if (Settings->GetInt("PipeSize")!=0) {
-    Settings->SetValue("JobMode",1);
-    TheProcessor->Run(dlProcessorPhase_Scale);
-  }
+  // The export runs TheProcessor on this thread.
+  PipeWorker->Stop();
+  UpdateProcessorSettings();
 
   WriteOut();
   CB_MenuFileExit(1);
@@ -669,6 +732,8 @@ void CB_MenuFileExit(const short) {
   // TODO Do we need some blabla before exiting ?
   printf("That's al folks ...\n");
 
+  PipeWorker->Stop();
+
   // Disable manual curves when closing
   for (int i = 0; i < CurveKeys.size(); i++) {
     if (Settings->GetInt(CurveKeys.at(i))==dlCurveChoice_Manual)
@@ -1008,6 +1073,13 @@ void CB_CurveWindowRecalc(const short Channel) {
   }
 }
 
+// While an anchor is dragged : the coarse preview only, the window
+// asks for CB_CurveWindowRecalc once the drag pauses or ends.
+void CB_CurveWindowDragged(const short Channel) {
+  assert(Channel >= dlCurveChannel_L && Channel <= dlCurveChannel_Saturation);
+  Update(dlProcessorPhase_Lab,dlProcessorMode_Drag);
+}
+
 void CB_CurveWindowManuallyChanged(const short Channel) {
 
   // Combobox and curve choice has to be adapted to manual.
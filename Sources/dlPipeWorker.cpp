@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+
+#include <lcms2.h>
+
+#include "dlPipeWorker.h"
+#include "dlConstants.h"
+#include "dlTransformCache.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Constructor
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlPipeWorker::dlPipeWorker(dlProcessor*  Processor,
+                           dlDisplayLut* DisplayLut,
+                           void (*Finished)(),
+                           void (*ReportProgress)(const QString Message)) {
+
+  m_Processor      = Processor;
+  m_DisplayLut     = DisplayLut;
+  m_Finished       = Finished;
+  m_ReportProgress = ReportProgress;
+
+  m_Request        = new dlPipeRequest;
+  m_HasRequest     = 0;
+  m_Stop           = 0;
+  m_Abort          = 0;
+
+  m_Region.Width   = 0;
+  m_HasRegion      = 0;
+  m_InDetail       = 0;
+
+  m_Running        = new dlPipeRequest;
+  // What a detail before the first run goes by.
+  m_Running->ProcessorMode = dlProcessorMode_Preview;
+  m_Running->PreviewMode   = dlPreviewMode_End;
+  m_Running->ViewLAB       = 0;
+  m_RunningRegion.Width = 0;
+  m_Detail         = new dlImage;
+  m_HasResult      = 0;
+  m_DetailRegion.Width = 0;
+  m_HasDetail      = 0;
+
+  // The pipe stops on m_Abort, so do its images.
+  m_Processor->m_Abort = &m_Abort;
+  m_Detail->m_Abort    = &m_Abort;
+
+  // This object lives on the gui thread : signals from the worker
+  // thread are queued, those of the gui thread itself called directly.
+  connect(this,SIGNAL(FinishedSignal()),
+          this,SLOT(FinishedSlot()));
+  connect(this,SIGNAL(ProgressSignal(const QString)),
+          this,SLOT(ProgressSlot(const QString)));
+
+  start();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Destructor
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlPipeWorker::~dlPipeWorker() {
+  Stop();
+  delete m_Request;
+  delete m_Running;
+  delete m_Detail;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Request
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlPipeWorker::Request(const short                Phase,
+                           const short                ProcessorMode,
+                           const dlProcessorSettings& Settings,
+                           dlCurve* const             Curves[4],
+                           const short                PreviewMode,
+                           const short                ViewLAB) {
+
+  QMutexLocker Locker(&m_Mutex);
+
+  // Merged with one not yet started.
+  m_Request->Phase = m_HasRequest ? MIN(m_Request->Phase,Phase) : Phase;
+  m_Request->ProcessorMode = ProcessorMode;
+  m_Request->Settings = Settings;
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    m_Request->Curves[Channel].Set(Curves[Channel]);
+  }
+  m_Request->PreviewMode = PreviewMode;
+  m_Request->ViewLAB     = ViewLAB;
+  m_HasRequest = 1;
+
+  // The one running is out of date.
+  m_Abort = 1;
+  m_WakeUp.wakeOne();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Take
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlPipeWorker::Take(QImage* Screen) {
+  QMutexLocker Locker(&m_Mutex);
+  if (!m_HasResult) return 0;
+  *Screen = m_ScreenResult;
+  m_HasResult = 0;
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RequestRegion
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlPipeWorker::RequestRegion(const dlPipeRegion& Region) {
+
+  QMutexLocker Locker(&m_Mutex);
+
+  // The same again (the view reports after each update) is no news.
+  if (Region.Width == m_Region.Width && Region.Height == m_Region.Height &&
+      Region.X == m_Region.X && Region.Y == m_Region.Y &&
+      Region.Level == m_Region.Level && Region.PipeSize == m_Region.PipeSize)
+    return;
+
+  m_Region    = Region;
+  m_HasRegion = 1;
+  if (m_InDetail) m_Abort = 1;
+  m_WakeUp.wakeOne();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// TakeDetail
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlPipeWorker::TakeDetail(QImage* Image, dlPipeRegion& Region) {
+  QMutexLocker Locker(&m_Mutex);
+  if (!m_HasDetail) return 0;
+  *Image = m_DetailResult;
+  Region = m_DetailRegion;
+  m_HasDetail = 0;
+  return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Stop
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlPipeWorker::Stop() {
+  m_Mutex.lock();
+  m_Stop  = 1;
+  m_Abort = 1;
+  m_WakeUp.wakeOne();
+  m_Mutex.unlock();
+  wait();
+  // The processor is the gui's again.
+  m_Processor->m_Abort = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Progress and finished, to the gui thread.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlPipeWorker::ReportProgress(const QString Message) {
+  emit(ProgressSignal(Message));
+}
+
+void dlPipeWorker::ProgressSlot(const QString Message) {
+  m_ReportProgress(Message);
+}
+
+void dlPipeWorker::FinishedSlot() {
+  m_Finished();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// run
+// The loop of the worker thread.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlPipeWorker::run() {
+
+  // Phase a stopped run still had to do, dlProcessorPhase_Output (only
+  // the preview) if none.
+  short Undone = dlProcessorPhase_Output;
+
+  while (1) {
+    m_Mutex.lock();
+    while (!m_HasRequest && !m_HasRegion && !m_Stop) m_WakeUp.wait(&m_Mutex);
+    if (m_Stop) {
+      m_Mutex.unlock();
+      return;
+    }
+    m_RunningRegion = m_Region;
+    m_HasRegion = 0;
+    m_Abort = 0;
+    // Only the region changed : only the detail.
+    if (!m_HasRequest) {
+      m_InDetail = 1;
+      m_Mutex.unlock();
+      MakeDetail();
+      continue;
+    }
+    m_Running->Phase = MIN(m_Request->Phase,Undone);
+    m_Running->ProcessorMode = m_Request->ProcessorMode;
+    m_Running->Settings = m_Request->Settings;
+    for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+      m_Running->Curves[Channel].Set(&m_Request->Curves[Channel]);
+      m_Running->Settings.Curves[Channel] = &m_Running->Curves[Channel];
+    }
+    m_Running->PreviewMode = m_Request->PreviewMode;
+    m_Running->ViewLAB     = m_Request->ViewLAB;
+    m_HasRequest = 0;
+    m_Mutex.unlock();
+
+    m_Processor->m_Settings = m_Running->Settings;
+    m_Processor->Run(m_Running->Phase,-1,1,m_Running->ProcessorMode);
+
+    const short PipeDone = !m_Abort;
+    if (PipeDone) MakePreview();
+
+    // The drag mode leaves the Lab phase of the pipe size to be done.
+    const short DoneUpTo = (m_Running->ProcessorMode == dlProcessorMode_Drag) ?
+      dlProcessorPhase_Lab : dlProcessorPhase_Output;
+
+    if (m_Abort) {
+      // A newer request is waiting, it takes over what is left.
+      Undone = PipeDone ? DoneUpTo : m_Running->Phase;
+      continue;
+    }
+    Undone = DoneUpTo;
+
+    m_Mutex.lock();
+    m_ScreenResult = m_Screen;
+    m_HasResult = 1;
+    // A detail not yet taken is of the previous preview.
+    m_HasDetail = 0;
+    m_InDetail  = 1;
+    m_Mutex.unlock();
+    emit(FinishedSignal());
+
+    // Not while dragging, the preview is coarse anyway.
+    if (m_Running->ProcessorMode == dlProcessorMode_Drag) {
+      m_Mutex.lock();
+      m_InDetail = 0;
+      m_Mutex.unlock();
+      continue;
+    }
+    MakeDetail();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// MakeDetail
+// The region of the level cut out, the Lab phase of the last run on it
+// and the preview as in MakePreview. Called with m_InDetail set, clears
+// it.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlPipeWorker::MakeDetail() {
+
+  const dlPipeRegion& Region = m_RunningRegion;
+  const dlImage* Source = (Region.Level == 0) ?
+    m_Processor->m_Image_AfterOpen : m_Processor->m_Image_Pyramid[Region.Level];
+
+  short Done = 0;
+  if (Region.Width && Source &&
+      Region.X < Source->m_Width && Region.Y < Source->m_Height) {
+    const uint32_t Width  = MIN(Region.Width,Source->m_Width-Region.X);
+    const uint32_t Height = MIN(Region.Height,Source->m_Height-Region.Y);
+
+    ReportProgress(QObject::tr("Detail"));
+    m_Detail->Set(Source);
+    m_Detail->Crop(Region.X,Region.Y,Width,Height);
+    if (m_Running->PreviewMode != dlPreviewMode_Tab)
+      m_Processor->RunLab(m_Detail);
+
+    cmsHTRANSFORM DisplayTransform;
+    DisplayTransform = dlTransformCache::Get(NULL,0,TYPE_Lab_16,
+                                             NULL,0,TYPE_RGB_16,
+                                             INTENT_PERCEPTUAL,
+                                             cmsFLAGS_BLACKPOINTCOMPENSATION);
+    if (DisplayTransform && !m_Abort) {
+      m_DisplayLut->Update(DisplayTransform);
+      // A new one : the gui may still hold the previous.
+      m_DetailScreen = QImage(m_Detail->m_Width,m_Detail->m_Height,
+                              QImage::Format_RGB32);
+      m_Detail->LabToScreen(m_DisplayLut,m_Running->ViewLAB,
+                            m_DetailScreen.bits(),
+                            m_DetailScreen.bytesPerLine());
+      Done = !m_Abort;
+    }
+    ReportProgress(QObject::tr("Ready"));
+  }
+
+  m_Mutex.lock();
+  m_InDetail = 0;
+  if (Done) {
+    m_DetailResult = m_DetailScreen;
+    m_DetailRegion = Region;
+    m_DetailRegion.Width  = m_Detail->m_Width;
+    m_DetailRegion.Height = m_Detail->m_Height;
+    m_HasDetail = 1;
+  }
+  m_Mutex.unlock();
+  if (Done) emit(FinishedSignal());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// MakePreview
+// The image shown : the scaled or the processed one, View LAB and the
+// conversion to the screen, in one pass from the pixels of the processor
+// to the scanlines of the 8 bit preview.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlPipeWorker::MakePreview() {
+
+  const short Drag = (m_Running->ProcessorMode == dlProcessorMode_Drag);
+
+  const dlImage* CurrentImage = Drag ?
+    m_Processor->m_Image_AfterLabCoarse : m_Processor->m_Image_AfterLab;
+  if (m_Running->PreviewMode == dlPreviewMode_Tab)
+    CurrentImage = Drag ?
+      m_Processor->m_Image_AfterScaleCoarse : m_Processor->m_Image_AfterScale;
+  if (!CurrentImage) return;
+
+  ReportProgress(QObject::tr("Converting to screen space"));
+
+  // The table is sampled again only if the transform changed.
+  cmsHTRANSFORM DisplayTransform;
+  DisplayTransform = dlTransformCache::Get(NULL,0,TYPE_Lab_16,
+                                           NULL,0,TYPE_RGB_16,
+                                           INTENT_PERCEPTUAL,
+                                           cmsFLAGS_BLACKPOINTCOMPENSATION);
+  if (!DisplayTransform) return;
+  m_DisplayLut->Update(DisplayTransform);
+
+  const short ViewLAB = m_Running->ViewLAB;
+
+  // A new QImage each time : the gui may still hold the previous.
+  if (Drag && m_Processor->m_CoarseBin) {
+    // Back to the size of the pipe, so the view keeps its zoom.
+    const uint32_t Width  = m_Processor->m_Image_AfterScale->m_Width;
+    const uint32_t Height = m_Processor->m_Image_AfterScale->m_Height;
+    m_Screen = QImage(Width,Height,QImage::Format_RGB32);
+    CurrentImage->LabToScreen(m_DisplayLut,ViewLAB,
+                              m_Screen.bits(),m_Screen.bytesPerLine(),
+                              m_Processor->m_CoarseBin,Width,Height);
+  } else {
+    m_Screen = QImage(CurrentImage->m_Width,CurrentImage->m_Height,
+                      QImage::Format_RGB32);
+    CurrentImage->LabToScreen(m_DisplayLut,ViewLAB,
+                              m_Screen.bits(),m_Screen.bytesPerLine());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,188 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DLPIPEWORKER_H
+#define DLPIPEWORKER_H
+
+#include <QtCore>
+#include <QImage>
+
+#include "dlImage.h"
+#include "dlCurve.h"
+#include "dlLut.h"
+#include "dlProcessor.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlPipeRequest
+// What the gui asks the pipe for : from which phase and in which mode
+// (dlProcessorMode_Drag or the preview), with which settings and curves
+// (copies, the gui goes on editing its own), and how to show the result.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct dlPipeRequest {
+short               Phase;
+short               ProcessorMode;
+dlProcessorSettings Settings;
+dlCurve             Curves[4];
+short               PreviewMode;
+short               ViewLAB;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlPipeRegion
+// A region of interest : X,Y Width x Height in pixels of pyramid level
+// Level (0 for the opened image), for pipe size PipeSize. No region if
+// Width is 0.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct dlPipeRegion {
+short    Level;
+short    PipeSize;
+uint32_t X;
+uint32_t Y;
+uint32_t Width;
+uint32_t Height;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlPipeWorker
+// Runs the pipe of the gui on a thread of its own, so the gui does not
+// wait for it.
+//
+// Request returns right away. The worker always runs the latest
+// request : requests coming in while one runs are merged into one,
+// from the earliest phase asked for. The run going on is stopped at
+// the next chunk of the operation it is in, as its result would be out
+// of date anyway, and what it left undone is redone by the next one.
+//
+// After the pipe the worker also makes the preview image (View LAB and
+// the conversion to the screen), in one pass from the pixels of the
+// processor to the 8 bit image the view and the histogram show. In the
+// drag mode it is made from the coarse level and expanded to the pipe
+// size on the way. On the gui thread the Finished callback then
+// announces it and Take gives it. Progress messages of the pipe reach
+// ReportProgress on the gui thread too.
+//
+// With a region of interest the worker then also runs the Lab phase and
+// the preview on that region of a finer level (the detail), for a view
+// zoomed in beyond the pipe size. A new region only stops and redoes
+// the detail, never the pipe.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+class dlPipeWorker : public QThread {
+
+Q_OBJECT
+
+public :
+
+// Constructor. Starts the thread.
+dlPipeWorker(dlProcessor*  Processor,
+             dlDisplayLut* DisplayLut,
+             void (*Finished)(),
+             void (*ReportProgress)(const QString Message));
+// Destructor. Stops the thread.
+~dlPipeWorker();
+
+// Run the pipe from Phase on in ProcessorMode, with a copy of Settings
+// and Curves.
+void Request(const short                Phase,
+             const short                ProcessorMode,
+             const dlProcessorSettings& Settings,
+             dlCurve* const             Curves[4],
+             const short                PreviewMode,
+             const short                ViewLAB);
+
+// The latest finished preview, shared into Screen. Returns 0 if there
+// is none since the last Take.
+short Take(QImage* Screen);
+
+// The region of interest, Width 0 for none.
+void RequestRegion(const dlPipeRegion& Region);
+
+// The latest detail, as Take, and its region.
+short TakeDetail(QImage* Image, dlPipeRegion& Region);
+
+// Stops the run going on and the thread, for instance before the
+// processor is used on the gui thread for the export.
+void Stop();
+
+// For the progress callback of the processor, from any thread.
+void ReportProgress(const QString Message);
+
+signals :
+void FinishedSignal();
+void ProgressSignal(const QString Message);
+
+private slots:
+void FinishedSlot();
+void ProgressSlot(const QString Message);
+
+protected:
+void run();
+
+private:
+void MakePreview();
+void MakeDetail();
+
+dlProcessor*   m_Processor;
+dlDisplayLut*  m_DisplayLut;
+void         (*m_Finished)();
+void         (*m_ReportProgress)(const QString Message);
+
+// Guards the request, the result and the flags.
+QMutex         m_Mutex;
+QWaitCondition m_WakeUp;
+dlPipeRequest* m_Request;
+short          m_HasRequest;
+short          m_Stop;
+// Non zero stops the pipe at the next chunk.
+QAtomicInt     m_Abort;
+
+// Region asked for, and whether a new one is waiting.
+dlPipeRegion   m_Region;
+short          m_HasRegion;
+// The detail is being made (a new region stops it).
+short          m_InDetail;
+
+// Owned by the thread.
+dlPipeRequest* m_Running;
+QImage         m_Screen;
+dlPipeRegion   m_RunningRegion;
+dlImage*       m_Detail;
+QImage         m_DetailScreen;
+
+QImage         m_ScreenResult;
+short          m_HasResult;
+QImage         m_DetailResult;
+dlPipeRegion   m_DetailRegion;
+short          m_HasDetail;
+};
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
@@ -21,14 +21,14 @@
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-#include <QFileInfo>
-#include <QApplication>
+#include <cstring>
+
+#include <QtCore>
 
 #include "assert.h"
 
 #include "dlConstants.h"
 #include "dlError.h"
-#include "dlSettings.h"
 #include "dlCurve.h"
 
 #include "dlProcessor.h"
@@ -48,14 +48,48 @@ dlProcessor::dlProcessor(void (*ReportProgress)(const QString Message)) {
   m_Image_AfterOpen        = NULL;
   m_Image_AfterScale       = NULL;
   m_Image_AfterLab         = NULL;
+  m_Image_AfterScaleCoarse = NULL;
+  for (short Level=0; Level <= dlPipeSize_Eighth; Level++) {
+    m_Image_Pyramid[Level] = NULL;
+  }
+  m_Image_AfterLabCoarse   = NULL;
+  m_CoarseBin              = 0;
+  m_CoarseValid            = 0;
+
+  m_Abort                  = NULL;
 
   //
   m_ProfileSize       = 0;
   m_ProfileBuffer     = NULL;
-}
 
-// Prototype for status report in Viewwindow
-void ViewWindowStatusReport(short State);
+  m_SaturationLut     = new dlSaturationLut();
+
+  // Nothing computed yet.
+  m_LabValid          = 0;
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    m_LabApplied[Channel] = 0;
+    m_LabCurves[Channel]  = (uint16_t*) CALLOC(0x10000,sizeof(uint16_t));
+    dlMemoryError(m_LabCurves[Channel],__FILE__,__LINE__);
+  }
+  m_LabSatCurveMode   = 0;
+  m_LabSatCurveType   = 0;
+
+  // Settings : nothing active until told otherwise.
+  m_Settings.InputFileName   = "";
+  m_Settings.JobMode         = 0;
+  m_Settings.PipeSize        = dlPipeSize_Full;
+  m_Settings.CurveL          = dlCurveChoice_None;
+  m_Settings.CurveLa         = dlCurveChoice_None;
+  m_Settings.CurveLb         = dlCurveChoice_None;
+  m_Settings.CurveSaturation = dlCurveChoice_None;
+  m_Settings.SatCurveMode    = 0;
+  m_Settings.SatCurveType    = 0;
+  m_Settings.Planar          = 0;
+  m_Settings.Tiled           = 0;
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    m_Settings.Curves[Channel] = NULL;
+  }
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -70,11 +104,21 @@ int dlProcessor::Open() {
   Timer.start();
   m_Image_AfterOpen = new dlImage();
   m_Image_AfterOpen->dlGMOpenImage(
-    Settings->GetString("InputFileName").toAscii().data(),
-    m_ProfileSize, m_ProfileBuffer, Success);
+    m_Settings.InputFileName.toAscii().data(),
+    m_ProfileSize, m_ProfileBuffer, Success, m_Settings.Tiled);
 
   TRACEMAIN("opened image at %d ms.",Timer.elapsed());
 
+  // The levels the gui scales to, in one pass.
+  if (Success && !m_Settings.JobMode && !m_Image_AfterOpen->IsTiled()) {
+    m_ReportProgress(QObject::tr("Building the pyramid"));
+    for (short Level=dlPipeSize_Half; Level <= dlPipeSize_Eighth; Level++) {
+      if (!m_Image_Pyramid[Level]) m_Image_Pyramid[Level] = new dlImage();
+    }
+    m_Image_AfterOpen->BinPyramid(m_Image_Pyramid);
+    TRACEMAIN("Done pyramid at %d ms.",Timer.elapsed());
+  }
+
   return Success;
 }
 
@@ -99,95 +143,294 @@ void dlProcessor::Run(short Phase,
   QTime Timer;
   Timer.start();
 
-  // Status report
-  ::ViewWindowStatusReport(2);
-
   switch(Phase) {
     case dlProcessorPhase_Scale :
 
-      if (Settings->GetInt("JobMode")) {
+      if (m_Settings.JobMode) {
         m_Image_AfterScale = m_Image_AfterOpen; // Job mode -> no cache
       } else {
-        if (!m_Image_AfterScale) m_Image_AfterScale = new dlImage();
-        m_Image_AfterScale->Set(m_Image_AfterOpen);
-      }
-
-      if (Settings->GetInt("JobMode")==0) {
         m_ReportProgress(QObject::tr("Scaling"));
 
-        m_Image_AfterScale->Bin(Settings->GetInt("PipeSize"));
+        // The pixels of the pyramid level, else binned straight from
+        // the opened image. No copy either way.
+        if (!m_Image_AfterScale) m_Image_AfterScale = new dlImage();
+        m_Image_AfterScale->m_Abort = m_Abort;
+        if (m_Image_Pyramid[m_Settings.PipeSize]) {
+          m_Image_AfterScale->Set(m_Image_Pyramid[m_Settings.PipeSize]);
+        } else {
+          m_Image_AfterScale->Bin(m_Image_AfterOpen,m_Settings.PipeSize);
+        }
+
+        if (m_Settings.Planar) m_Image_AfterScale->ToPlanar();
 
         TRACEMAIN("Done scaling at %d ms.",Timer.elapsed());
       }
+      m_LabValid    = 0;
+      m_CoarseValid = 0;
+      if (Aborted()) goto Exit;
 
     case dlProcessorPhase_Lab :
 
-      if (Settings->GetInt("JobMode")) {
+      if (m_Settings.JobMode) {
         m_Image_AfterLab = m_Image_AfterScale; // Job mode -> no cache
+        RunLab(m_Image_AfterLab);
+      } else if (ProcessorMode == dlProcessorMode_Drag) {
+        RunLabCoarse();
       } else {
-        if (!m_Image_AfterLab) m_Image_AfterLab = new dlImage();
-        m_Image_AfterLab->Set(m_Image_AfterScale);
+        RunLabCached();
       }
 
-      // L Curve
+    case dlProcessorPhase_Output : // Run Output.
 
-      if (Settings->GetInt("CurveL")) {
-        m_ReportProgress(QObject::tr("Applying L curve"));
 
-        m_Image_AfterLab->ApplyCurve(Curve[dlCurveChannel_L],1);
+Exit:
 
-        TRACEMAIN("Done L Curve at %d ms.",Timer.elapsed());
-      }
+      TRACEMAIN("Done pipe processing at %d ms.",Timer.elapsed());
 
-      // a Curve
+      break;
 
-      if (Settings->GetInt("CurveLa")) {
-        m_ReportProgress(QObject::tr("Applying a curve"));
+    default : // Should not happen.
+      assert(0);
+  }
 
-        m_Image_AfterLab->ApplyCurve(Curve[dlCurveChannel_a],2);
+  m_ReportProgress(QObject::tr("Ready"));
+}
 
-        TRACEMAIN("Done a Curve at %d ms.",Timer.elapsed());
-      }
+////////////////////////////////////////////////////////////////////////////////
+//
+// RunLab
+// The curves of the Lab phase, in place on Image.
+// Shared by Run and the batch mode (dlBatch).
+//
+////////////////////////////////////////////////////////////////////////////////
 
-      // b Curve
+void dlProcessor::RunLab(dlImage* Image) {
 
-      if (Settings->GetInt("CurveLb")) {
-        m_ReportProgress(QObject::tr("Applying b curve"));
+  QTime Timer;
+  Timer.start();
 
-        m_Image_AfterLab->ApplyCurve(Curve[dlCurveChannel_b],4);
+  // The curves that are set and do something, in one pass.
+  // A curve left NULL is skipped by ApplyLabCurves.
 
-        TRACEMAIN("Done b Curve at %d ms.",Timer.elapsed());
-      }
+  const dlCurve*         LabCurve[4];
+  const dlSaturationLut* SaturationLut;
+  if (!SelectLabCurves(LabCurve,SaturationLut)) return;
 
-      // Saturation Curve
+  m_ReportProgress(QObject::tr("Applying Lab curves"));
+  TRACEMAIN("Lookups on the %s path.",dlLutPath());
 
-      if (Settings->GetInt("CurveSaturation")) {
-        m_ReportProgress(QObject::tr("Applying saturation curve"));
+  Image->ApplyLabCurves(LabCurve[dlCurveChannel_L],
+                        LabCurve[dlCurveChannel_a],
+                        LabCurve[dlCurveChannel_b],
+                        SaturationLut);
 
-        m_Image_AfterLab->ApplySaturationCurve(Curve[dlCurveChannel_Saturation],
-                                               Settings->GetInt("SatCurveMode"),
-                                               Settings->GetInt("SatCurveType"));
+  TRACEMAIN("Done Lab curves at %d ms.",Timer.elapsed());
+}
 
-        TRACEMAIN("Done saturation Curve at %d ms.",Timer.elapsed());
-      }
+////////////////////////////////////////////////////////////////////////////////
+//
+// RunLabCached
+// The Lab phase on the cached m_Image_AfterLab. After scaling all
+// channels are read from m_Image_AfterScale, after that only the
+// channels whose curve changed are read again and looked up.
+// Editing the b curve then costs the b channel only, the saturation is
+// redone when one of its inputs or the curve itself changed.
+//
+////////////////////////////////////////////////////////////////////////////////
 
-      Settings->SetValue("PipeImageW",m_Image_AfterLab->m_Width);
-      Settings->SetValue("PipeImageH",m_Image_AfterLab->m_Height);
+void dlProcessor::RunLabCached() {
 
-    case dlProcessorPhase_Output : // Run Output.
+  QTime Timer;
+  Timer.start();
 
+  const dlCurve*         LabCurve[4];
+  const dlSaturationLut* SaturationLut;
+  SelectLabCurves(LabCurve,SaturationLut);
+
+  if (!m_Image_AfterLab) m_Image_AfterLab = new dlImage();
+  m_Image_AfterLab->m_Abort = m_Abort;
+
+  // From scratch all channels are redone. Until then m_Image_AfterLab
+  // shares the pixels of m_Image_AfterScale, no copy is made.
+  uint8_t Redo = 7;
+  if (!m_LabValid ||
+      m_Image_AfterLab->IsPlanar() != m_Image_AfterScale->IsPlanar()) {
+    m_Image_AfterLab->Set(m_Image_AfterScale);
+  } else {
+    Redo = LabChannelsToRedo(LabCurve);
+  }
 
-Exit:
+  TRACEMAIN("Lab channels to redo : mask %d.",Redo);
+  if (Redo) {
+    m_ReportProgress(QObject::tr("Applying Lab curves"));
+    TRACEMAIN("Lookups on the %s path.",dlLutPath());
+    m_Image_AfterLab->ApplyLabCurves(m_Image_AfterScale,Redo,
+                                     LabCurve[dlCurveChannel_L],
+                                     LabCurve[dlCurveChannel_a],
+                                     LabCurve[dlCurveChannel_b],
+                                     SaturationLut);
+    TRACEMAIN("Done Lab curves at %d ms.",Timer.elapsed());
+  }
 
-      TRACEMAIN("Done pipe processing at %d ms.",Timer.elapsed());
+  // Stopped half way : redo all next time.
+  if (Aborted()) {
+    m_LabValid = 0;
+    return;
+  }
+  LabDone(LabCurve);
+}
 
-      break;
+////////////////////////////////////////////////////////////////////////////////
+//
+// RunLabCoarse
+// The Lab phase of the drag mode. m_Image_AfterScale is binned down to
+// at most dlProcessor_DragPixels once, the curves are then applied to
+// all channels each time : at that size it costs less than keeping
+// track of what changed.
+//
+////////////////////////////////////////////////////////////////////////////////
 
-    default : // Should not happen.
-      assert(0);
+void dlProcessor::RunLabCoarse() {
+
+  QTime Timer;
+  Timer.start();
+
+  if (!m_Image_AfterScaleCoarse) m_Image_AfterScaleCoarse = new dlImage();
+  if (!m_Image_AfterLabCoarse)   m_Image_AfterLabCoarse   = new dlImage();
+  m_Image_AfterScaleCoarse->m_Abort = m_Abort;
+  m_Image_AfterLabCoarse->m_Abort   = m_Abort;
+
+  if (!m_CoarseValid) {
+    m_CoarseBin = 0;
+    while (m_CoarseBin < dlPipeSize_Eighth &&
+           ((uint64_t)m_Image_AfterScale->m_Width>>m_CoarseBin)*
+           (m_Image_AfterScale->m_Height>>m_CoarseBin) >
+           dlProcessor_DragPixels) {
+      m_CoarseBin++;
+    }
+    const short Level = m_Settings.PipeSize+m_CoarseBin;
+    if (m_CoarseBin && Level <= dlPipeSize_Eighth && m_Image_Pyramid[Level]) {
+      m_Image_AfterScaleCoarse->Set(m_Image_Pyramid[Level]);
+    } else {
+      m_Image_AfterScaleCoarse->Bin(m_Image_AfterScale,m_CoarseBin);
+    }
+    if (Aborted()) return;
+    m_CoarseValid = 1;
+    TRACEMAIN("Done coarse level at %d ms.",Timer.elapsed());
   }
 
-  m_ReportProgress(QObject::tr("Ready"));
+  const dlCurve*         LabCurve[4];
+  const dlSaturationLut* SaturationLut;
+  SelectLabCurves(LabCurve,SaturationLut);
+
+  // Shares the pixels, ApplyLabCurves gives it its own.
+  m_Image_AfterLabCoarse->Set(m_Image_AfterScaleCoarse);
+  m_Image_AfterLabCoarse->ApplyLabCurves(m_Image_AfterScaleCoarse,7,
+                                         LabCurve[dlCurveChannel_L],
+                                         LabCurve[dlCurveChannel_a],
+                                         LabCurve[dlCurveChannel_b],
+                                         SaturationLut);
+
+  TRACEMAIN("Done coarse Lab curves at %d ms.",Timer.elapsed());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabChannelsToRedo
+// Compares the curves with those m_Image_AfterLab was made with.
+// The saturation writes a and b from a, b and (by luminance) L, so it
+// forces a and b when it or one of those inputs changed.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+uint8_t dlProcessor::LabChannelsToRedo(const dlCurve* LabCurve[4]) const {
+
+  short Changed[4];
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    const short Applied = (LabCurve[Channel] != NULL);
+    Changed[Channel] =
+      Applied != m_LabApplied[Channel] ||
+      (Applied && memcmp(LabCurve[Channel]->m_Curve,m_LabCurves[Channel],
+                         0x10000*sizeof(uint16_t)));
+  }
+
+  uint8_t Redo = 0;
+  for (short Channel=0; Channel < dlCurveChannel_Saturation; Channel++) {
+    if (Changed[Channel]) Redo |= 1<<Channel;
+  }
+
+  const short Saturation = m_LabApplied[dlCurveChannel_Saturation];
+  if (Changed[dlCurveChannel_Saturation] ||
+      (Saturation && (m_Settings.SatCurveMode != m_LabSatCurveMode ||
+                      m_Settings.SatCurveType != m_LabSatCurveType))) {
+    Redo |= 6;
+  } else if (Saturation &&
+             (Redo & (m_Settings.SatCurveType ? 7 : 6))) {
+    Redo |= 6;
+  }
+  return Redo;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabDone
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlProcessor::LabDone(const dlCurve* LabCurve[4]) {
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    m_LabApplied[Channel] = (LabCurve[Channel] != NULL);
+    if (LabCurve[Channel])
+      memcpy(m_LabCurves[Channel],LabCurve[Channel]->m_Curve,
+             0x10000*sizeof(uint16_t));
+  }
+  m_LabSatCurveMode = m_Settings.SatCurveMode;
+  m_LabSatCurveType = m_Settings.SatCurveType;
+  m_LabValid        = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SelectLabCurves
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlProcessor::SelectLabCurves(const dlCurve*          LabCurve[4],
+                                   const dlSaturationLut*& SaturationLut) {
+
+  const short Choice[4] = {m_Settings.CurveL,
+                           m_Settings.CurveLa,
+                           m_Settings.CurveLb,
+                           m_Settings.CurveSaturation};
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    const dlCurve* ThisCurve = m_Settings.Curves[Channel];
+    if (!ThisCurve) ThisCurve = Curve[Channel];
+    LabCurve[Channel] = NULL;
+    if (Choice[Channel] && !ThisCurve->IsNull(Channel))
+      LabCurve[Channel] = ThisCurve;
+  }
+
+  SaturationLut = NULL;
+  if (LabCurve[dlCurveChannel_Saturation]) {
+    m_SaturationLutMutex.lock();
+    m_SaturationLut->Update(LabCurve[dlCurveChannel_Saturation],
+                            m_Settings.SatCurveMode,
+                            m_Settings.SatCurveType);
+    m_SaturationLutMutex.unlock();
+    SaturationLut = m_SaturationLut;
+  }
+
+  return LabCurve[0] || LabCurve[1] || LabCurve[2] || LabCurve[3];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Aborted
+//
+////////////////////////////////////////////////////////////////////////////////
+
+short dlProcessor::Aborted() const {
+  return m_Abort && *m_Abort;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -201,7 +444,12 @@ dlProcessor::~dlProcessor() {
   QList <dlImage*> PointerList;
   PointerList << m_Image_AfterOpen
               << m_Image_AfterScale
-              << m_Image_AfterLab;
+              << m_Image_AfterLab
+              << m_Image_AfterScaleCoarse
+              << m_Image_AfterLabCoarse
+              << m_Image_Pyramid[dlPipeSize_Half]
+              << m_Image_Pyramid[dlPipeSize_Quarter]
+              << m_Image_Pyramid[dlPipeSize_Eighth];
   while(PointerList.size()) {
     dlImage* CurrentPointer = PointerList[0];
     delete CurrentPointer;
@@ -215,6 +463,10 @@ dlProcessor::~dlProcessor() {
       }
     }
   }
+  delete m_SaturationLut;
+  for (short Channel=0; Channel <= dlCurveChannel_Saturation; Channel++) {
+    FREE(m_LabCurves[Channel]);
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -26,8 +26,45 @@
 
 #include <QString>
 #include <QTime>
+#include <QMutex>
+#include <QAtomicInt>
 
 #include "dlImage.h"
+#include "dlLut.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlProcessorSettings
+// The subset of the settings the pipe depends on. The gui copies them
+// from Settings before each run, a job fills them directly. That way
+// the processor does not depend on dlSettings and its gui elements.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+struct dlProcessorSettings {
+QString InputFileName;
+short   JobMode;
+short   PipeSize;
+short   CurveL;
+short   CurveLa;
+short   CurveLb;
+short   CurveSaturation;
+short   SatCurveMode;
+short   SatCurveType;
+// Keep the cached images planar, so single channel work touches
+// only that channel. Not for job mode, which has no cache.
+short   Planar;
+// Decode into tiles allocated on demand (dlImage::m_Tiles), for
+// panoramas too large for one piece. Job mode only.
+short   Tiled;
+// The curves, NULL for the program wide Curve. The gui worker thread
+// points them at its own copies, the gui goes on editing Curve.
+const dlCurve* Curves[4];
+};
+
+// Most pixels of the coarse level the drag mode runs on, about what
+// the Lab curves and the screen conversion do at a frame rate.
+const uint32_t dlProcessor_DragPixels = 0x40000;
 
 class dlProcessor {
 
@@ -38,10 +75,32 @@ dlImage*  m_Image_AfterOpen;
 dlImage*  m_Image_AfterScale;
 dlImage*  m_Image_AfterLab;
 
+// m_Image_AfterOpen binned to each pipe size, made once by Open (not in
+// job mode). The scale phase then shares the pixels of a level instead
+// of reading the full size image. [0] is m_Image_AfterOpen itself and
+// left NULL.
+dlImage*  m_Image_Pyramid[4];
+
+// The coarse level of dlProcessorMode_Drag : m_Image_AfterScale binned
+// by m_CoarseBin more (a level of the pyramid if there is one), and its
+// Lab phase. Made on the first drag after scaling.
+dlImage*  m_Image_AfterScaleCoarse;
+dlImage*  m_Image_AfterLabCoarse;
+short     m_CoarseBin;
+
 // Reporting back
 void (*m_ReportProgress)(const QString Message);
 void (*m_UpdateGUI)();
 
+// Settings the pipe runs with.
+dlProcessorSettings m_Settings;
+
+// When set and non zero, Run stops at the next chunk and leaves the
+// cached images incomplete (the next Run from an earlier phase redoes
+// them). Set by the gui worker thread (dlPipeWorker).
+const QAtomicInt* m_Abort;
+short Aborted() const;
+
 // Constructor
 dlProcessor(void (*ReportProgress)(const QString Message));
 // Destructor
@@ -54,12 +113,21 @@ short NextSubPhase;
 // Open the image
 int Open();
 
-// The real processing.
+// The real processing. With dlProcessorMode_Drag the Lab phase runs on
+// the coarse level only, leaving m_Image_AfterLab as it was.
 void Run(short Phase,
          short SubPhase      = -1,
          short WithIdentify  = 1,
          short ProcessorMode = dlProcessorMode_Preview);
 
+// The curves of the Lab phase, in place on any image.
+void RunLab(dlImage* Image);
+
+// The curves of the Lab phase that are set and do something, the
+// others are left NULL. Returns 0 if there is nothing to apply.
+short SelectLabCurves(const dlCurve*          LabCurve[4],
+                      const dlSaturationLut*& SaturationLut);
+
 // Reporting
 void ReportProgress(const QString Message);
 
@@ -67,6 +135,33 @@ void ReportProgress(const QString Message);
 long m_ProfileSize;
 uint8_t* m_ProfileBuffer;
 
+private:
+// Tables of the saturation curve, kept between runs.
+// The mutex guards the update, RunLab is shared by the batch threads.
+dlSaturationLut* m_SaturationLut;
+QMutex           m_SaturationLutMutex;
+
+// What m_Image_AfterLab was made with : per channel whether a curve was
+// applied and a copy of it, and the saturation mode and type. The Lab
+// phase redoes only the channels that differ. m_LabValid is cleared
+// when m_Image_AfterScale changes.
+short     m_LabValid;
+short     m_LabApplied[4];
+uint16_t* m_LabCurves[4];
+short     m_LabSatCurveMode;
+short     m_LabSatCurveType;
+// Whether m_Image_AfterScaleCoarse is made from m_Image_AfterScale.
+short     m_CoarseValid;
+
+// The Lab phase on the cached images.
+void    RunLabCached();
+// The Lab phase on the coarse level, all channels each time.
+void    RunLabCoarse();
+// Channel mask (1 L, 2 a, 4 b) of what the Lab phase has to redo.
+uint8_t LabChannelsToRedo(const dlCurve* LabCurve[4]) const;
+// Note LabCurve as what m_Image_AfterLab is made with.
+void    LabDone(const dlCurve* LabCurve[4]);
+
 };
 
 #endif
@@ -0,0 +1,529 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+#include "dlRGBLab.h"
+#include "dlCurve.h"
+#include "dlError.h"
+#include "dlTransformCache.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define DL_RGBLAB_X86
+  #include <immintrin.h>
+#endif
+
+QMutex                            dlRGBLab::m_Mutex;
+QMap <QByteArray,const dlRGBLab*> dlRGBLab::m_Matches;
+dlRGBLab*                         dlRGBLab::m_Spaces[dlSpace_ProPhotoRGB_D50+1];
+
+// D50 white of the profile connection space, as in lcms.
+const double dlRGBLab_D50[3] = {0.9642,1.0,0.8249};
+
+// CIE Lab constants, 216/24389 and 24389/27.
+const float dlRGBLab_Epsilon = 0.008856452f;
+const float dlRGBLab_Kappa   = 903.2963f;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Transfer functions of the spaces, on [0,1].
+// Adobe RGB and Wide Gamut RGB are 563/256 as in their profiles.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static double ToLinear(const short Space, const double Value) {
+  switch (Space) {
+    case dlSpace_sRGB_D65:
+      return InverseGammaSRGB(Value,0,0);
+    case dlSpace_ProPhotoRGB_D50:
+      return pow(Value,1.8);
+    default:
+      return pow(Value,563.0/256);
+  }
+}
+
+static double FromLinear(const short Space, const double Value) {
+  switch (Space) {
+    case dlSpace_sRGB_D65:
+      return GammaSRGB(Value,0,0);
+    case dlSpace_ProPhotoRGB_D50:
+      return pow(Value,1/1.8);
+    default:
+      return pow(Value,256/563.0);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Invert a 3x3 matrix.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void Invert(const double In[3][3], double Out[3][3]) {
+  const double Det =
+      In[0][0]*(In[1][1]*In[2][2]-In[1][2]*In[2][1])
+    - In[0][1]*(In[1][0]*In[2][2]-In[1][2]*In[2][0])
+    + In[0][2]*(In[1][0]*In[2][1]-In[1][1]*In[2][0]);
+  for (short i=0; i<3; i++) {
+    for (short j=0; j<3; j++) {
+      // Cofactor of the transposed element.
+      const short r0 = (j+1)%3, r1 = (j+2)%3;
+      const short c0 = (i+1)%3, c1 = (i+2)%3;
+      Out[i][j] = (In[r0][c0]*In[r1][c1]-In[r0][c1]*In[r1][c0])/Det;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Scalar versions. Also do the tails of the vector versions.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void ToLabScalar(const float*   Linear,
+                        const float    ToXYZ[3][3],
+                        uint16_t       (*Pixels)[3],
+                        const uint32_t NrPixels) {
+  for (uint32_t i=0; i<NrPixels; i++) {
+    const float R = Linear[Pixels[i][0]];
+    const float G = Linear[Pixels[i][1]];
+    const float B = Linear[Pixels[i][2]];
+    float f[3];
+    for (short k=0; k<3; k++) {
+      const float t = ToXYZ[k][0]*R + ToXYZ[k][1]*G + ToXYZ[k][2]*B;
+      f[k] = (t > dlRGBLab_Epsilon) ?
+        cbrtf(t) : (dlRGBLab_Kappa*t+16)/116;
+    }
+    Pixels[i][0] = CLIP((int32_t)((116*f[1]-16)*655.35f+0.5f));
+    Pixels[i][1] = CLIP((int32_t)((500*(f[0]-f[1])+128)*257+0.5f));
+    Pixels[i][2] = CLIP((int32_t)((200*(f[1]-f[2])+128)*257+0.5f));
+  }
+}
+
+static void FromLabScalar(const float*   Gamma,
+                          const float    FromXYZ[3][3],
+                          uint16_t       (*Pixels)[3],
+                          const uint32_t NrPixels) {
+  for (uint32_t i=0; i<NrPixels; i++) {
+    float f[3];
+    f[1] = (Pixels[i][0]/655.35f+16)/116;
+    f[0] = f[1] + (Pixels[i][1]/257.0f-128)/500;
+    f[2] = f[1] - (Pixels[i][2]/257.0f-128)/200;
+    float XYZ[3];
+    for (short k=0; k<3; k++) {
+      XYZ[k] = (f[k] > 6.0f/29) ?
+        f[k]*f[k]*f[k] : (116*f[k]-16)/dlRGBLab_Kappa;
+    }
+    for (short c=0; c<3; c++) {
+      float Value = FromXYZ[c][0]*XYZ[0] +
+                    FromXYZ[c][1]*XYZ[1] +
+                    FromXYZ[c][2]*XYZ[2];
+      Value = LIM(Value,0.0f,1.0f)*dlRGBLab_GammaSize;
+      const int32_t Index = MIN((int32_t)Value,dlRGBLab_GammaSize-1);
+      const float   Frac  = Value-Index;
+      Pixels[i][c] = (uint16_t)
+        (Gamma[Index] + Frac*(Gamma[Index+1]-Gamma[Index]) + 0.5f);
+    }
+  }
+}
+
+#ifdef DL_RGBLAB_X86
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// CubeRootAVX2
+// For Value > 0 : exponent divided by 3 on the bits as first guess,
+// then 3 Newton steps (relative error below 1e-7).
+//
+////////////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static inline __m256 CubeRootAVX2(const __m256 Value) {
+  const __m256  Third = _mm256_set1_ps(1.0f/3);
+  const __m256i Magic = _mm256_set1_epi32(709921077);
+  __m256 Root = _mm256_castsi256_ps(_mm256_add_epi32(Magic,
+    _mm256_cvttps_epi32(_mm256_mul_ps(Third,
+      _mm256_cvtepi32_ps(_mm256_castps_si256(Value))))));
+  for (short k=0; k<3; k++) {
+    Root = _mm256_mul_ps(Third,_mm256_add_ps(_mm256_add_ps(Root,Root),
+             _mm256_div_ps(Value,_mm256_mul_ps(Root,Root))));
+  }
+  return Root;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ToLabAVX2, FromLabAVX2
+// As the scalar versions, 8 pixels per step. The 32 bit gathers of the
+// pixels read 2 bytes past the b of the last pixel, so these stop one
+// pixel before NrPixels. Return the pixels done.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+__attribute__((target("avx2")))
+static uint32_t ToLabAVX2(const float*   Linear,
+                          const float    ToXYZ[3][3],
+                          uint16_t       (*Pixels)[3],
+                          const uint32_t NrPixels) {
+
+  const __m256i Index3  = _mm256_setr_epi32(0,3,6,9,12,15,18,21);
+  const __m256i Mask    = _mm256_set1_epi32(0xffff);
+  const __m256i Zero    = _mm256_setzero_si256();
+  const __m256  Epsilon = _mm256_set1_ps(dlRGBLab_Epsilon);
+  const __m256  Slope   = _mm256_set1_ps(dlRGBLab_Kappa/116);
+  const __m256  Offset  = _mm256_set1_ps(16.0f/116);
+  const __m256  Half    = _mm256_set1_ps(0.5f);
+
+  __m256 Matrix[3][3];
+  for (short k=0; k<3; k++) {
+    for (short c=0; c<3; c++) Matrix[k][c] = _mm256_set1_ps(ToXYZ[k][c]);
+  }
+
+  uint32_t i = 0;
+  for (; i+8 < NrPixels; i+=8) {
+    __m256 RGB[3];
+    for (short c=0; c<3; c++) {
+      __m256i Index = _mm256_and_si256(Mask,
+        _mm256_i32gather_epi32((const int*) &Pixels[i][c],Index3,2));
+      RGB[c] = _mm256_i32gather_ps(Linear,Index,4);
+    }
+    __m256 f[3];
+    for (short k=0; k<3; k++) {
+      __m256 t = _mm256_mul_ps(Matrix[k][0],RGB[0]);
+      t = _mm256_add_ps(t,_mm256_mul_ps(Matrix[k][1],RGB[1]));
+      t = _mm256_add_ps(t,_mm256_mul_ps(Matrix[k][2],RGB[2]));
+      f[k] = _mm256_blendv_ps(
+        _mm256_add_ps(_mm256_mul_ps(Slope,t),Offset),
+        CubeRootAVX2(_mm256_max_ps(t,Epsilon)),
+        _mm256_cmp_ps(t,Epsilon,_CMP_GT_OQ));
+    }
+    __m256 Lab[3];
+    Lab[0] = _mm256_mul_ps(_mm256_set1_ps(116*655.35f),
+                           _mm256_sub_ps(f[1],Offset));
+    Lab[1] = _mm256_add_ps(_mm256_set1_ps(128*257),
+               _mm256_mul_ps(_mm256_set1_ps(500*257),
+                             _mm256_sub_ps(f[0],f[1])));
+    Lab[2] = _mm256_add_ps(_mm256_set1_ps(128*257),
+               _mm256_mul_ps(_mm256_set1_ps(200*257),
+                             _mm256_sub_ps(f[1],f[2])));
+
+    int32_t Out[3][8];
+    for (short c=0; c<3; c++) {
+      __m256i Value = _mm256_cvttps_epi32(_mm256_add_ps(Lab[c],Half));
+      Value = _mm256_min_epi32(_mm256_max_epi32(Value,Zero),Mask);
+      _mm256_storeu_si256((__m256i*) Out[c],Value);
+    }
+    for (short k=0; k<8; k++) {
+      Pixels[i+k][0] = Out[0][k];
+      Pixels[i+k][1] = Out[1][k];
+      Pixels[i+k][2] = Out[2][k];
+    }
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static uint32_t FromLabAVX2(const float*   Gamma,
+                            const float    FromXYZ[3][3],
+                            uint16_t       (*Pixels)[3],
+                            const uint32_t NrPixels) {
+
+  const __m256i Index3 = _mm256_setr_epi32(0,3,6,9,12,15,18,21);
+  const __m256i Mask   = _mm256_set1_epi32(0xffff);
+  const __m256i Last   = _mm256_set1_epi32(dlRGBLab_GammaSize-1);
+  const __m256  Zero   = _mm256_setzero_ps();
+  const __m256  One    = _mm256_set1_ps(1.0f);
+  const __m256  Half   = _mm256_set1_ps(0.5f);
+  const __m256  Edge   = _mm256_set1_ps(6.0f/29);
+  const __m256  Slope  = _mm256_set1_ps(116/dlRGBLab_Kappa);
+  const __m256  Offset = _mm256_set1_ps(16/dlRGBLab_Kappa);
+  const __m256  Size   = _mm256_set1_ps((float)dlRGBLab_GammaSize);
+
+  __m256 Matrix[3][3];
+  for (short c=0; c<3; c++) {
+    for (short k=0; k<3; k++) Matrix[c][k] = _mm256_set1_ps(FromXYZ[c][k]);
+  }
+
+  uint32_t i = 0;
+  for (; i+8 < NrPixels; i+=8) {
+    __m256 Lab[3];
+    for (short c=0; c<3; c++) {
+      Lab[c] = _mm256_cvtepi32_ps(_mm256_and_si256(Mask,
+        _mm256_i32gather_epi32((const int*) &Pixels[i][c],Index3,2)));
+    }
+    __m256 f[3];
+    f[1] = _mm256_mul_ps(_mm256_set1_ps(1.0f/116),
+             _mm256_add_ps(_mm256_mul_ps(Lab[0],_mm256_set1_ps(1/655.35f)),
+                           _mm256_set1_ps(16.0f)));
+    f[0] = _mm256_add_ps(f[1],_mm256_mul_ps(_mm256_set1_ps(1.0f/500),
+             _mm256_sub_ps(_mm256_mul_ps(Lab[1],_mm256_set1_ps(1/257.0f)),
+                           _mm256_set1_ps(128.0f))));
+    f[2] = _mm256_sub_ps(f[1],_mm256_mul_ps(_mm256_set1_ps(1.0f/200),
+             _mm256_sub_ps(_mm256_mul_ps(Lab[2],_mm256_set1_ps(1/257.0f)),
+                           _mm256_set1_ps(128.0f))));
+    __m256 XYZ[3];
+    for (short k=0; k<3; k++) {
+      XYZ[k] = _mm256_blendv_ps(
+        _mm256_sub_ps(_mm256_mul_ps(Slope,f[k]),Offset),
+        _mm256_mul_ps(f[k],_mm256_mul_ps(f[k],f[k])),
+        _mm256_cmp_ps(f[k],Edge,_CMP_GT_OQ));
+    }
+
+    int32_t Out[3][8];
+    for (short c=0; c<3; c++) {
+      __m256 Value = _mm256_mul_ps(Matrix[c][0],XYZ[0]);
+      Value = _mm256_add_ps(Value,_mm256_mul_ps(Matrix[c][1],XYZ[1]));
+      Value = _mm256_add_ps(Value,_mm256_mul_ps(Matrix[c][2],XYZ[2]));
+      Value = _mm256_mul_ps(Size,_mm256_min_ps(_mm256_max_ps(Value,Zero),One));
+      __m256i Index = _mm256_min_epi32(_mm256_cvttps_epi32(Value),Last);
+      __m256  Frac  = _mm256_sub_ps(Value,_mm256_cvtepi32_ps(Index));
+      __m256  G0    = _mm256_i32gather_ps(Gamma,Index,4);
+      __m256  G1    = _mm256_i32gather_ps(Gamma+1,Index,4);
+      Value = _mm256_add_ps(G0,_mm256_mul_ps(Frac,_mm256_sub_ps(G1,G0)));
+      _mm256_storeu_si256((__m256i*) Out[c],
+                          _mm256_cvttps_epi32(_mm256_add_ps(Value,Half)));
+    }
+    for (short k=0; k<8; k++) {
+      Pixels[i+k][0] = Out[0][k];
+      Pixels[i+k][1] = Out[1][k];
+      Pixels[i+k][2] = Out[2][k];
+    }
+  }
+  return i;
+}
+
+static short SelectAVX2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+static const short HasAVX2 = SelectAVX2();
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Constructor
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlRGBLab::dlRGBLab(const short Space) {
+
+  assert (Space >= dlSpace_sRGB_D65 && Space <= dlSpace_ProPhotoRGB_D50);
+
+  m_Space = Space;
+
+  // The D65 spaces are adapted to D50 like the colorants of a profile.
+  const short D65 = (Space == dlSpace_sRGB_D65 ||
+                     Space == dlSpace_AdobeRGB_D65);
+  double D65ToD50[3][3];
+  Invert(MatrixBradfordD50ToD65,D65ToD50);
+
+  double ToXYZ[3][3];
+  for (short i=0; i<3; i++) {
+    for (short j=0; j<3; j++) {
+      ToXYZ[i][j] = MatrixRGBToXYZ[Space][i][j];
+      if (D65) {
+        ToXYZ[i][j] = 0;
+        for (short k=0; k<3; k++) {
+          ToXYZ[i][j] += D65ToD50[i][k]*MatrixRGBToXYZ[Space][k][j];
+        }
+      }
+    }
+  }
+  // Relative to the white, as the Lab formulas need it.
+  for (short i=0; i<3; i++) {
+    for (short j=0; j<3; j++) ToXYZ[i][j] /= dlRGBLab_D50[i];
+  }
+  double FromXYZ[3][3];
+  Invert(ToXYZ,FromXYZ);
+  for (short i=0; i<3; i++) {
+    for (short j=0; j<3; j++) {
+      m_ToXYZ[i][j]   = ToXYZ[i][j];
+      m_FromXYZ[i][j] = FromXYZ[i][j];
+    }
+  }
+
+  for (uint32_t i=0; i<0x10000; i++) {
+    m_Linear[i] = ToLinear(Space,i/(double)0xffff);
+  }
+  for (int i=0; i<=dlRGBLab_GammaSize; i++) {
+    m_Gamma[i] = FromLinear(Space,i/(double)dlRGBLab_GammaSize)*0xffff;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ToLab, FromLab
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlRGBLab::ToLab(uint16_t (*Pixels)[3],
+                     const uint32_t NrPixels) const {
+  uint32_t Done = 0;
+#ifdef DL_RGBLAB_X86
+  if (HasAVX2) Done = ToLabAVX2(m_Linear,m_ToXYZ,Pixels,NrPixels);
+#endif
+  ToLabScalar(m_Linear,m_ToXYZ,Pixels+Done,NrPixels-Done);
+}
+
+void dlRGBLab::FromLab(uint16_t (*Pixels)[3],
+                       const uint32_t NrPixels) const {
+  uint32_t Done = 0;
+#ifdef DL_RGBLAB_X86
+  if (HasAVX2) Done = FromLabAVX2(m_Gamma,m_FromXYZ,Pixels,NrPixels);
+#endif
+  FromLabScalar(m_Gamma,m_FromXYZ,Pixels+Done,NrPixels-Done);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// LargestDeltaE
+// Between two sets of Lab pixels.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static double LargestDeltaE(const uint16_t (*Lab1)[3],
+                            const uint16_t (*Lab2)[3],
+                            const uint32_t NrPixels) {
+  double Largest = 0;
+  for (uint32_t i=0; i<NrPixels; i++) {
+    cmsCIELab Value1;
+    cmsCIELab Value2;
+    cmsLabEncoded2Float(&Value1,Lab1[i]);
+    cmsLabEncoded2Float(&Value2,Lab2[i]);
+    Largest = MAX(Largest,cmsDeltaE(&Value1,&Value2));
+  }
+  return Largest;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Check
+// Largest difference to the lcms transforms on a grid over the RGB
+// cube. To Lab the Lab values are compared, back from the Lab of lcms
+// the RGB values are compared by their Lab.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+double dlRGBLab::Check(cmsHTRANSFORM ToLabTransform,
+                       cmsHTRANSFORM FromLabTransform) const {
+
+  const int32_t  N        = dlRGBLab_CheckSize;
+  const uint32_t NrPixels = N*N*N;
+  uint16_t (*Reference)[3] =
+    (uint16_t (*)[3]) CALLOC(NrPixels,sizeof(*Reference));
+  dlMemoryError(Reference,__FILE__,__LINE__);
+  uint16_t (*Computed)[3] =
+    (uint16_t (*)[3]) CALLOC(NrPixels,sizeof(*Computed));
+  dlMemoryError(Computed,__FILE__,__LINE__);
+  const size_t Bytes = NrPixels*sizeof(*Reference);
+
+  uint32_t Node = 0;
+  for (int32_t R=0; R<N; R++) {
+    for (int32_t G=0; G<N; G++) {
+      for (int32_t B=0; B<N; B++) {
+        Reference[Node][0] = R*0xffff/(N-1);
+        Reference[Node][1] = G*0xffff/(N-1);
+        Reference[Node][2] = B*0xffff/(N-1);
+        Node++;
+      }
+    }
+  }
+  memcpy(Computed,Reference,Bytes);
+  cmsDoTransform(ToLabTransform,Reference,Reference,NrPixels);
+  ToLab(Computed,NrPixels);
+  double Largest = LargestDeltaE(Reference,Computed,NrPixels);
+
+  if (Largest <= dlRGBLab_MaxDeltaE) {
+    memcpy(Computed,Reference,Bytes);
+    cmsDoTransform(FromLabTransform,Reference,Reference,NrPixels);
+    FromLab(Computed,NrPixels);
+    ToLab(Reference,NrPixels);
+    ToLab(Computed,NrPixels);
+    Largest = MAX(Largest,LargestDeltaE(Reference,Computed,NrPixels));
+  }
+
+  FREE(Reference);
+  FREE(Computed);
+  return Largest;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Get
+// The spaces are tried in order, sRGB first. Without profile the
+// transforms are the lcms sRGB, so only that one is tried.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+const dlRGBLab* dlRGBLab::Get(const uint8_t* ProfileBuffer,
+                              const long     ProfileSize) {
+
+  const short HasProfile = (ProfileBuffer && ProfileSize > 0);
+  QByteArray Key("sRGB");
+  if (HasProfile) {
+    Key = QCryptographicHash::hash(
+      QByteArray::fromRawData((const char*) ProfileBuffer,ProfileSize),
+      QCryptographicHash::Md5);
+  }
+
+  QMutexLocker Locker(&m_Mutex);
+
+  if (m_Matches.contains(Key)) return m_Matches.value(Key);
+
+  // The same transforms the callers use otherwise.
+  cmsHTRANSFORM ToLabTransform;
+  ToLabTransform = dlTransformCache::Get(ProfileBuffer,ProfileSize,
+                                         TYPE_RGB_16,
+                                         NULL,0,TYPE_Lab_16,
+                                         INTENT_PERCEPTUAL,
+                                         cmsFLAGS_BLACKPOINTCOMPENSATION);
+  cmsHTRANSFORM FromLabTransform;
+  FromLabTransform = dlTransformCache::Get(NULL,0,TYPE_Lab_16,
+                                           ProfileBuffer,ProfileSize,
+                                           TYPE_RGB_16,
+                                           INTENT_PERCEPTUAL,
+                                           cmsFLAGS_BLACKPOINTCOMPENSATION);
+
+  const dlRGBLab* Match = NULL;
+  if (ToLabTransform && FromLabTransform) {
+    const short Last = HasProfile ? dlSpace_ProPhotoRGB_D50 : dlSpace_sRGB_D65;
+    for (short Space = dlSpace_sRGB_D65; Space <= Last && !Match; Space++) {
+      if (!m_Spaces[Space]) m_Spaces[Space] = new dlRGBLab(Space);
+      const double DeltaE = m_Spaces[Space]->Check(ToLabTransform,
+                                                   FromLabTransform);
+      if (DeltaE <= dlRGBLab_MaxDeltaE) {
+        Match = m_Spaces[Space];
+        TRACEMAIN("Built in space matches, delta E %.3f.",DeltaE);
+      }
+    }
+  }
+
+  m_Matches.insert(Key,Match);
+  return Match;
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DLRGBLAB_H
+#define DLRGBLAB_H
+
+#include <QtCore>
+
+#include <lcms2.h>
+
+#include "dlDefines.h"
+#include "dlConstants.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlRGBLab
+// 16 bit RGB to and from 16 bit Lab (v4 encoding, D50) for the built in
+// spaces dlSpace_sRGB_D65 up to dlSpace_ProPhotoRGB_D50, computed
+// instead of through lcms : transfer function from a table, the matrix
+// of dlConstants (Bradford adapted to D50 like the ICC colorants) and
+// the Lab formulas. 8 pixels per step with AVX2 when the cpu allows.
+//
+// Get gives the space matching a profile, sRGB without profile. A
+// space matches if it agrees with the lcms transforms of the profile
+// within dlRGBLab_MaxDeltaE on a grid over the RGB cube, both ways.
+// Otherwise it is NULL and the caller stays on lcms. The outcome is
+// kept per profile for the process, like dlTransformCache.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Largest CIE76 difference to lcms accepted for a match.
+const double dlRGBLab_MaxDeltaE = 1.0;
+
+// Nodes per axis of the grid checked against lcms.
+const int dlRGBLab_CheckSize = 17;
+
+// Entries of the table from linear to the transfer function.
+const int dlRGBLab_GammaSize = 0x10000;
+
+class dlRGBLab {
+public:
+
+// The space for the profile (sRGB if there is none), NULL if none
+// matches. Owned by dlRGBLab, callers must not delete it.
+static const dlRGBLab* Get(const uint8_t* ProfileBuffer,
+                           const long     ProfileSize);
+
+// In place on NrPixels pixels. Single threaded, callers split the
+// image over the threads.
+void ToLab(uint16_t (*Pixels)[3],
+           const uint32_t NrPixels) const;
+void FromLab(uint16_t (*Pixels)[3],
+             const uint32_t NrPixels) const;
+
+// One of dlSpace_sRGB_D65 .. dlSpace_ProPhotoRGB_D50.
+short m_Space;
+
+private:
+dlRGBLab(const short Space);
+double Check(cmsHTRANSFORM ToLabTransform,
+             cmsHTRANSFORM FromLabTransform) const;
+
+// RGB to XYZ relative to the D50 white and back.
+float m_ToXYZ[3][3];
+float m_FromXYZ[3][3];
+// 16 bit value to linear in [0,1].
+float m_Linear[0x10000];
+// Linear in [0,1] to 16 bit, interpolated.
+float m_Gamma[dlRGBLab_GammaSize+1];
+
+static QMutex                            m_Mutex;
+static QMap <QByteArray,const dlRGBLab*> m_Matches;
+static dlRGBLab*                         m_Spaces[dlSpace_ProPhotoRGB_D50+1];
+};
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,350 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+#include "dlResize.h"
+#include "dlError.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// The filters (dlResizeFilter_xxx), on the distance in source pixels at
+// scale 1. The cubic ones are the Mitchell-Netravali family for their
+// B and C, the quadratic ones Dodgson's for r = 1 (interpolating) and
+// r = 1/2 (the B-spline, which is also the bell). Unknown filters are
+// taken as the triangle.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static double FilterRadius(const short Filter) {
+  switch (Filter) {
+    case dlResizeFilter_Box              : return 0.5;
+    case dlResizeFilter_Quadratic        :
+    case dlResizeFilter_QuadraticBSpline :
+    case dlResizeFilter_Bell             : return 1.5;
+    case dlResizeFilter_CubicBSpline     :
+    case dlResizeFilter_CubicConvolution :
+    case dlResizeFilter_Mitchell         :
+    case dlResizeFilter_CatmullRom       : return 2.0;
+    case dlResizeFilter_Lanczos3         : return 3.0;
+    default                              : return 1.0;
+  }
+}
+
+static double Cubic(const double x, const double B, const double C) {
+  if (x < 1.0) {
+    return ((12-9*B-6*C)*x*x*x + (-18+12*B+6*C)*x*x + (6-2*B))/6;
+  }
+  if (x < 2.0) {
+    return ((-B-6*C)*x*x*x + (6*B+30*C)*x*x + (-12*B-48*C)*x +
+            (8*B+24*C))/6;
+  }
+  return 0.0;
+}
+
+static double Quadratic(const double x, const double r) {
+  if (x <= 0.5) return -2*r*x*x + 0.5*(r+1);
+  if (x <= 1.5) return r*x*x + (-2*r-0.5)*x + 0.75*(r+1);
+  return 0.0;
+}
+
+static double Sinc(const double x) {
+  if (x == 0.0) return 1.0;
+  return sin(dlPI*x)/(dlPI*x);
+}
+
+static double FilterValue(const short Filter, const double Distance) {
+  const double x = fabs(Distance);
+  switch (Filter) {
+    case dlResizeFilter_Box :
+      return (x < 0.5) ? 1.0 : 0.0;
+    case dlResizeFilter_Quadratic :
+      return Quadratic(x,1.0);
+    case dlResizeFilter_QuadraticBSpline :
+    case dlResizeFilter_Bell :
+      return Quadratic(x,0.5);
+    case dlResizeFilter_CubicBSpline :
+      return Cubic(x,1.0,0.0);
+    case dlResizeFilter_CubicConvolution :
+      return Cubic(x,0.0,0.75);
+    case dlResizeFilter_Mitchell :
+      return Cubic(x,1.0/3,1.0/3);
+    case dlResizeFilter_CatmullRom :
+      return Cubic(x,0.0,0.5);
+    case dlResizeFilter_Lanczos3 :
+      return (x < 3.0) ? Sinc(x)*Sinc(x/3) : 0.0;
+    case dlResizeFilter_Cosine :
+      return (x < 1.0) ? 0.5+0.5*cos(dlPI*x) : 0.0;
+    case dlResizeFilter_Hermite :
+      return (x < 1.0) ? (2*x-3)*x*x+1 : 0.0;
+    default :
+      return (x < 1.0) ? 1.0-x : 0.0;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlResizeWeights constructor
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlResizeWeights::dlResizeWeights(const uint32_t SourceSize,
+                                 const double   Scale,
+                                 const uint32_t Start,
+                                 const uint32_t Size,
+                                 const short    Filter) {
+
+  assert (SourceSize && Size && Scale > 0.0);
+
+  const double Support = (Scale < 1.0) ? 1.0/Scale : 1.0;
+  const double Radius  = FilterRadius(Filter)*Support;
+
+  m_Size    = Size;
+  m_Taps    = (short) MIN(ceil(2*Radius)+1,(double)SourceSize);
+  m_First   = (uint32_t*) CALLOC(Size,sizeof(*m_First));
+  dlMemoryError(m_First,__FILE__,__LINE__);
+  m_Weights = (float*) CALLOC((size_t)Size*m_Taps,sizeof(*m_Weights));
+  dlMemoryError(m_Weights,__FILE__,__LINE__);
+
+  const int32_t Last = SourceSize-m_Taps;
+
+  for (uint32_t i=0; i<Size; i++) {
+    // Centre of the output pixel, in source pixels.
+    const double Centre = (Start+i+0.5)/Scale;
+    int32_t From = (int32_t) floor(Centre-Radius+0.5);
+    int32_t To   = (int32_t) floor(Centre+Radius+0.5);
+    From = MAX(From,0);
+    To   = MIN(MIN(To,(int32_t)SourceSize),From+m_Taps);
+
+    // Kept within the source, the weights moved along.
+    const int32_t First = MAX(MIN(From,Last),0);
+    float* Weights = m_Weights+(size_t)i*m_Taps;
+
+    double Sum = 0.0;
+    for (int32_t j=From; j<To; j++) {
+      const double Weight = FilterValue(Filter,(j+0.5-Centre)/Support);
+      Weights[j-First] = Weight;
+      Sum += Weight;
+    }
+    if (Sum > 0.0) {
+      for (short k=0; k<m_Taps; k++) Weights[k] /= Sum;
+    } else {
+      // Nothing in reach (beyond the edge) : the nearest pixel.
+      const int32_t Nearest =
+        MAX(MIN((int32_t)Centre,(int32_t)SourceSize-1),0);
+      Weights[Nearest-First] = 1.0f;
+    }
+    m_First[i] = First;
+  }
+}
+
+dlResizeWeights::~dlResizeWeights() {
+  FREE(m_First);
+  FREE(m_Weights);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SourceRows
+// The source rows the part from Rows needs : from First, Number of them.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void SourceRows(const dlResizeWeights& Rows,
+                       uint32_t&              First,
+                       uint32_t&              Number) {
+  First  = Rows.m_First[0];
+  Number = Rows.m_First[Rows.m_Size-1]+Rows.m_Taps-First;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ColumnPass
+// Row Row of the result down the columns into Sum, LineSize floats, from
+// Between : the source rows from FirstRow on, after the pass along the
+// rows. Whole rows at once, so the loops vectorize.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static void ColumnPass(const float*           Between,
+                       const dlResizeWeights& Rows,
+                       const uint32_t         FirstRow,
+                       const size_t           LineSize,
+                       const uint32_t         Row,
+                       float*                 Sum) {
+
+  const short  Taps    = Rows.m_Taps;
+  const float* Weights = Rows.m_Weights+(size_t)Row*Taps;
+  const float* In      = Between+(Rows.m_First[Row]-FirstRow)*LineSize;
+
+  for (size_t i=0; i<LineSize; i++) Sum[i] = Weights[0]*In[i];
+  for (short k=1; k<Taps; k++) {
+    const float  Weight = Weights[k];
+    const float* Line   = In+k*LineSize;
+    for (size_t i=0; i<LineSize; i++) Sum[i] += Weight*Line[i];
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlResize
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlResize(const uint8_t* Source,
+              const uint32_t SourceWidth,
+              const uint32_t SourceHeight,
+              const int32_t  SourceBytesPerLine,
+              const double   Scale,
+              const uint32_t X,
+              const uint32_t Y,
+              const uint32_t Width,
+              const uint32_t Height,
+              uint8_t*       Target,
+              const int32_t  TargetBytesPerLine,
+              const short    Filter) {
+
+  assert (Source && Target);
+  if (!Width || !Height) return;
+
+  const dlResizeWeights Columns(SourceWidth,Scale,X,Width,Filter);
+  const dlResizeWeights Rows(SourceHeight,Scale,Y,Height,Filter);
+
+  const short  Taps     = Columns.m_Taps;
+  const size_t LineSize = (size_t)4*Width;
+
+  uint32_t FirstRow;
+  uint32_t NrRows;
+  SourceRows(Rows,FirstRow,NrRows);
+
+  float* Between = (float*) CALLOC2(NrRows*LineSize,sizeof(*Between));
+  dlMemoryError(Between,__FILE__,__LINE__);
+
+  // Along the rows.
+#pragma omp parallel for schedule(static)
+  for (uint32_t Row=0; Row<NrRows; Row++) {
+    const uint8_t* Line = Source+(size_t)(FirstRow+Row)*SourceBytesPerLine;
+    float* Out = Between+Row*LineSize;
+    for (uint32_t Col=0; Col<Width; Col++) {
+      const uint8_t* Pixel   = Line+4*(size_t)Columns.m_First[Col];
+      const float*   Weights = Columns.m_Weights+(size_t)Col*Taps;
+      float Sum[4] = {0.0f,0.0f,0.0f,0.0f};
+      for (short k=0; k<Taps; k++) {
+        for (short c=0; c<4; c++) Sum[c] += Weights[k]*Pixel[4*k+c];
+      }
+      for (short c=0; c<4; c++) Out[4*Col+c] = Sum[c];
+    }
+  }
+
+  // Down the columns.
+#pragma omp parallel
+  {
+    float* Sum = (float*) CALLOC2(LineSize,sizeof(*Sum));
+    dlMemoryError(Sum,__FILE__,__LINE__);
+
+#pragma omp for schedule(static)
+    for (uint32_t Row=0; Row<Height; Row++) {
+      ColumnPass(Between,Rows,FirstRow,LineSize,Row,Sum);
+      uint8_t* Out = Target+(size_t)Row*TargetBytesPerLine;
+      for (size_t i=0; i<LineSize; i++) {
+        const float Value = Sum[i]+0.5f;
+        Out[i] = (uint8_t) (Value < 0.0f ? 0.0f :
+                            Value > 255.0f ? 255.0f : Value);
+      }
+    }
+
+    free(Sum);
+  }
+
+  free(Between);
+}
+
+void dlResize(const uint16_t (*Source)[3],
+              const uint32_t SourceWidth,
+              const uint32_t SourceHeight,
+              const double   Scale,
+              const uint32_t X,
+              const uint32_t Y,
+              const uint32_t Width,
+              const uint32_t Height,
+              uint16_t       (*Target)[3],
+              const short    Filter) {
+
+  assert (Source && Target);
+  if (!Width || !Height) return;
+
+  const dlResizeWeights Columns(SourceWidth,Scale,X,Width,Filter);
+  const dlResizeWeights Rows(SourceHeight,Scale,Y,Height,Filter);
+
+  const short  Taps     = Columns.m_Taps;
+  const size_t LineSize = (size_t)3*Width;
+
+  uint32_t FirstRow;
+  uint32_t NrRows;
+  SourceRows(Rows,FirstRow,NrRows);
+
+  float* Between = (float*) CALLOC2(NrRows*LineSize,sizeof(*Between));
+  dlMemoryError(Between,__FILE__,__LINE__);
+
+  // Along the rows.
+#pragma omp parallel for schedule(static)
+  for (uint32_t Row=0; Row<NrRows; Row++) {
+    const uint16_t (*Line)[3] = Source+(size_t)(FirstRow+Row)*SourceWidth;
+    float* Out = Between+Row*LineSize;
+    for (uint32_t Col=0; Col<Width; Col++) {
+      const uint16_t (*Pixel)[3] = Line+Columns.m_First[Col];
+      const float*   Weights     = Columns.m_Weights+(size_t)Col*Taps;
+      float Sum[3] = {0.0f,0.0f,0.0f};
+      for (short k=0; k<Taps; k++) {
+        for (short c=0; c<3; c++) Sum[c] += Weights[k]*Pixel[k][c];
+      }
+      for (short c=0; c<3; c++) Out[3*Col+c] = Sum[c];
+    }
+  }
+
+  // Down the columns.
+#pragma omp parallel
+  {
+    float* Sum = (float*) CALLOC2(LineSize,sizeof(*Sum));
+    dlMemoryError(Sum,__FILE__,__LINE__);
+
+#pragma omp for schedule(static)
+    for (uint32_t Row=0; Row<Height; Row++) {
+      ColumnPass(Between,Rows,FirstRow,LineSize,Row,Sum);
+      uint16_t* Out = (uint16_t*) (Target+(size_t)Row*Width);
+      for (size_t i=0; i<LineSize; i++) {
+        const float Value = Sum[i]+0.5f;
+        Out[i] = (uint16_t) (Value < 0.0f ? 0.0f :
+                             Value > 65535.0f ? 65535.0f : Value);
+      }
+    }
+
+    free(Sum);
+  }
+
+  free(Between);
+}
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DLRESIZE_H
+#define DLRESIZE_H
+
+#include "dlDefines.h"
+#include "dlConstants.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlResizeWeights
+// The taps of a separable resize in one direction. For output position
+// i (from Start on) the source positions m_First[i] .. m_First[i]+m_Taps-1
+// get the weights m_Weights[i*m_Taps ..], zero padded where the filter
+// reaches less far and always within the source, so the loops over the
+// taps have a fixed length. Shrinking, the filter (dlResizeFilter_xxx) is
+// widened by 1/Scale, so it averages all the source pixels it covers.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+class dlResizeWeights {
+public:
+
+dlResizeWeights(const uint32_t SourceSize,
+                const double   Scale,
+                const uint32_t Start,
+                const uint32_t Size,
+                const short    Filter);
+~dlResizeWeights();
+
+uint32_t  m_Size;
+short     m_Taps;
+uint32_t* m_First;
+float*    m_Weights;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlResize
+// Resizes 8 bit pixels of 4 channels (QImage::Format_RGB32 or ARGB32,
+// as dlImage8) by Scale, computing only the part X,Y Width x Height of
+// the result, into Target. Rows are BytesPerLine apart in both. First
+// along the rows into a float buffer for the source rows the part
+// needs, then down the columns ; both passes spread the rows over the
+// threads.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlResize(const uint8_t* Source,
+              const uint32_t SourceWidth,
+              const uint32_t SourceHeight,
+              const int32_t  SourceBytesPerLine,
+              const double   Scale,
+              const uint32_t X,
+              const uint32_t Y,
+              const uint32_t Width,
+              const uint32_t Height,
+              uint8_t*       Target,
+              const int32_t  TargetBytesPerLine,
+              const short    Filter = dlResizeFilter_Triangle);
+
+// The same for 16 bit pixels of 3 channels (interleaved dlImage), the
+// rows of both without padding.
+void dlResize(const uint16_t (*Source)[3],
+              const uint32_t SourceWidth,
+              const uint32_t SourceHeight,
+              const double   Scale,
+              const uint32_t X,
+              const uint32_t Y,
+              const uint32_t Width,
+              const uint32_t Height,
+              uint16_t       (*Target)[3],
+              const short    Filter = dlResizeFilter_Triangle);
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,483 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "dlTransformCache.h"
+#include "dlConstants.h"
+#include "dlError.h"
+
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+
+#ifdef __linux__
+  #include <unistd.h>
+#endif
+
+QMutex                                    dlTransformCache::m_Mutex;
+QMap <QByteArray,cmsHTRANSFORM>           dlTransformCache::m_Transforms;
+QMap <cmsHTRANSFORM,dlTransformRecipe>    dlTransformCache::m_Recipes;
+QThreadStorage <dlTransformCopies*>       dlTransformCache::m_Threads;
+QString                                   dlTransformCache::m_Directory;
+
+// Version of the device links written.
+const double dlTransformCache_DeviceLinkVersion = 4.3;
+
+// L2 cache assumed if the system does not tell.
+const long dlTransformCache_L2Size = 256*1024;
+// Smallest chunk, below that the per chunk overhead shows.
+const int32_t dlTransformCache_MinChunk = 4096;
+// Chunks per thread at least, for the balance.
+const int32_t dlTransformCache_ChunksPerThread = 4;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ProfileKey
+// MD5 of the ICC buffer, or the name of the built in profile.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+QByteArray dlTransformCache::ProfileKey(const uint8_t*        ProfileBuffer,
+                                        const long            ProfileSize,
+                                        const cmsUInt32Number Format) {
+  if (ProfileBuffer && ProfileSize > 0) {
+    return QCryptographicHash::hash(
+      QByteArray::fromRawData((const char*) ProfileBuffer,ProfileSize),
+      QCryptographicHash::Md5);
+  }
+  return (T_COLORSPACE(Format) == PT_Lab) ? "Lab" : "sRGB";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// OpenProfile
+// In Context (NULL for the global one). Built in if Profile is empty
+// or does not open.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+cmsHPROFILE dlTransformCache::OpenProfile(cmsContext            Context,
+                                          const QByteArray      Profile,
+                                          const cmsUInt32Number Format) {
+  cmsHPROFILE Handle = NULL;
+  if (Profile.size()) {
+    Handle = cmsOpenProfileFromMemTHR(Context,
+                                      Profile.constData(),
+                                      Profile.size());
+  }
+  if (!Handle) {
+    Handle = (T_COLORSPACE(Format) == PT_Lab) ?
+      cmsCreateLab4ProfileTHR(Context,NULL) :
+      cmsCreate_sRGBProfileTHR(Context);
+  }
+  return Handle;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Build
+// The transform of Recipe in Context. NULL if it cannot be built.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+cmsHTRANSFORM dlTransformCache::Build(cmsContext               Context,
+                                      const dlTransformRecipe& Recipe) {
+
+  cmsHTRANSFORM Transform = NULL;
+
+  if (Recipe.DeviceLink.size()) {
+    cmsHPROFILE DeviceLink =
+      cmsOpenProfileFromMemTHR(Context,
+                               Recipe.DeviceLink.constData(),
+                               Recipe.DeviceLink.size());
+    if (!DeviceLink) return NULL;
+    Transform = cmsCreateTransformTHR(Context,
+                                      DeviceLink,
+                                      Recipe.InFormat,
+                                      NULL,
+                                      Recipe.OutFormat,
+                                      Recipe.Intent,
+                                      Recipe.Flags);
+    cmsCloseProfile(DeviceLink);
+    return Transform;
+  }
+
+  cmsHPROFILE Profiles[3];
+  short Opened = 0;
+  for (short i=0; i<Recipe.NrProfiles; i++) {
+    if (Recipe.NrProfiles == 3 && i == 1) {
+      // A Lab profile in between that does not open is an error,
+      // not an identity.
+      Profiles[i] = cmsOpenProfileFromMemTHR(Context,
+                                             Recipe.Profiles[i].constData(),
+                                             Recipe.Profiles[i].size());
+      if (!Profiles[i]) break;
+    } else {
+      Profiles[i] = OpenProfile(Context,
+                                Recipe.Profiles[i],
+                                Recipe.ProfileFormats[i]);
+    }
+    Opened++;
+  }
+
+  if (Opened == Recipe.NrProfiles) {
+    Transform = cmsCreateMultiprofileTransformTHR(Context,
+                                                  Profiles,
+                                                  Recipe.NrProfiles,
+                                                  Recipe.InFormat,
+                                                  Recipe.OutFormat,
+                                                  Recipe.Intent,
+                                                  Recipe.Flags);
+  }
+
+  // A transform does not need its profiles any more.
+  for (short i=0; i<Opened; i++) cmsCloseProfile(Profiles[i]);
+
+  return Transform;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SetDirectory, DefaultDirectory
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlTransformCache::SetDirectory(const QString Directory) {
+  QMutexLocker Locker(&m_Mutex);
+  m_Directory = Directory;
+  if (!m_Directory.isEmpty() && !QDir().mkpath(m_Directory)) {
+    dlLogWarning(dlError_FileOpen,"Cannot create '%s', no transform cache",
+                 m_Directory.toAscii().data());
+    m_Directory = "";
+  }
+}
+
+QString dlTransformCache::DefaultDirectory() {
+  return QDir::homePath() + "/.LabCurves/TransformCache";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DeviceLinkFileName
+// The key holds binary MD5s, the file is named after its own MD5.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+QString dlTransformCache::DeviceLinkFileName(const QByteArray Key) {
+  QString Name(QCryptographicHash::hash(Key,QCryptographicHash::Md5).toHex());
+  return QDir(m_Directory).filePath(Name + ".icc");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// LoadDeviceLink
+// The device link saved for Key, empty if there is none.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+QByteArray dlTransformCache::LoadDeviceLink(const QByteArray Key) {
+  QByteArray DeviceLink;
+  if (m_Directory.isEmpty()) return DeviceLink;
+
+  // Read once, kept with the recipe for the copies per thread.
+  QFile File(DeviceLinkFileName(Key));
+  if (!File.open(QIODevice::ReadOnly)) return DeviceLink;
+  DeviceLink = File.readAll();
+  if (DeviceLink.size() != File.size()) DeviceLink.clear();
+  return DeviceLink;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SaveDeviceLink
+// Written under a temporary name and renamed, so a process running
+// at the same time never reads a half written one.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlTransformCache::SaveDeviceLink(const QByteArray Key,
+                                      cmsHTRANSFORM    Transform) {
+  if (m_Directory.isEmpty()) return;
+
+  cmsHPROFILE DeviceLink =
+    cmsTransform2DeviceLink(Transform,dlTransformCache_DeviceLinkVersion,0);
+  if (!DeviceLink) return;
+
+  cmsUInt32Number Size = 0;
+  QByteArray Buffer;
+  if (cmsSaveProfileToMem(DeviceLink,NULL,&Size)) {
+    Buffer.resize(Size);
+    if (!cmsSaveProfileToMem(DeviceLink,Buffer.data(),&Size)) Size = 0;
+  }
+  cmsCloseProfile(DeviceLink);
+  if (!Size) return;
+
+  const QString FileName = DeviceLinkFileName(Key);
+  const QString TempName =
+    FileName + QString(".%1").arg(QCoreApplication::applicationPid());
+  QFile File(TempName);
+  if (!File.open(QIODevice::WriteOnly)) return;
+  const short Written = (File.write(Buffer) == Buffer.size());
+  File.close();
+  // Fails if another process was first, which is fine.
+  if (!Written || !QFile::rename(TempName,FileName)) QFile::remove(TempName);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Get
+//
+////////////////////////////////////////////////////////////////////////////////
+
+cmsHTRANSFORM dlTransformCache::Get(const uint8_t*        InProfileBuffer,
+                                    const long            InProfileSize,
+                                    const cmsUInt32Number InFormat,
+                                    const uint8_t*        OutProfileBuffer,
+                                    const long            OutProfileSize,
+                                    const cmsUInt32Number OutFormat,
+                                    const cmsUInt32Number Intent,
+                                    const cmsUInt32Number Flags) {
+  return Get(InProfileBuffer,InProfileSize,InFormat,
+             NULL,0,
+             OutProfileBuffer,OutProfileSize,OutFormat,
+             Intent,Flags);
+}
+
+cmsHTRANSFORM dlTransformCache::Get(const uint8_t*        InProfileBuffer,
+                                    const long            InProfileSize,
+                                    const cmsUInt32Number InFormat,
+                                    const uint8_t*        LabProfileBuffer,
+                                    const long            LabProfileSize,
+                                    const uint8_t*        OutProfileBuffer,
+                                    const long            OutProfileSize,
+                                    const cmsUInt32Number OutFormat,
+                                    const cmsUInt32Number Intent,
+                                    const cmsUInt32Number Flags) {
+
+  const short HasLabProfile = (LabProfileBuffer && LabProfileSize > 0);
+
+  QByteArray Key = ProfileKey(InProfileBuffer,InProfileSize,InFormat);
+  Key += '|';
+  if (HasLabProfile) {
+    Key += ProfileKey(LabProfileBuffer,LabProfileSize,TYPE_Lab_16);
+    Key += '|';
+  }
+  Key += ProfileKey(OutProfileBuffer,OutProfileSize,OutFormat);
+  Key += QString("|%1|%2|%3|%4").arg(InFormat).arg(OutFormat)
+                                .arg(Intent).arg(Flags).toAscii();
+
+  QMutexLocker Locker(&m_Mutex);
+
+  cmsHTRANSFORM Transform = m_Transforms.value(Key,NULL);
+  if (Transform) return Transform;
+
+  QTime Timer;
+  Timer.start();
+
+  dlTransformRecipe Recipe;
+  Recipe.InFormat   = InFormat;
+  Recipe.OutFormat  = OutFormat;
+  Recipe.Intent     = Intent;
+  Recipe.Flags      = Flags;
+  Recipe.NrProfiles = 0;
+  if (!HasLabProfile) Recipe.DeviceLink = LoadDeviceLink(Key);
+
+  if (Recipe.DeviceLink.size()) {
+    Transform = Build(NULL,Recipe);
+    if (Transform) {
+      m_Transforms.insert(Key,Transform);
+      m_Recipes.insert(Transform,Recipe);
+      ThreadCopies()->Copies.insert(Transform,Transform);
+      TRACEMAIN("Loaded a transform in %d ms.",Timer.elapsed());
+      return Transform;
+    }
+    // Not usable, built from the profiles as if there was none.
+    Recipe.DeviceLink = QByteArray();
+  }
+
+  const uint8_t* Buffers[3] = {InProfileBuffer,
+                               LabProfileBuffer,
+                               OutProfileBuffer};
+  const long     Sizes[3]   = {InProfileSize,
+                               LabProfileSize,
+                               OutProfileSize};
+  const cmsUInt32Number Formats[3] = {InFormat,TYPE_Lab_16,OutFormat};
+  for (short i=0; i<3; i++) {
+    if (i == 1 && !HasLabProfile) continue;
+    if (Buffers[i] && Sizes[i] > 0) {
+      Recipe.Profiles[Recipe.NrProfiles] =
+        QByteArray((const char*) Buffers[i],Sizes[i]);
+    }
+    Recipe.ProfileFormats[Recipe.NrProfiles] = Formats[i];
+    Recipe.NrProfiles++;
+  }
+
+  Transform = Build(NULL,Recipe);
+
+  if (!Transform) {
+    dlLogError(dlError_lcms,"Cannot create a transform");
+    return NULL;
+  }
+
+  m_Transforms.insert(Key,Transform);
+  m_Recipes.insert(Transform,Recipe);
+  ThreadCopies()->Copies.insert(Transform,Transform);
+  TRACEMAIN("Created a transform in %d ms.",Timer.elapsed());
+
+  if (!HasLabProfile) SaveDeviceLink(Key,Transform);
+
+  return Transform;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlTransformCopies
+// The originals are in the global context and owned by the cache.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlTransformCopies::dlTransformCopies() {
+  Context = cmsCreateContext(NULL,NULL);
+}
+
+dlTransformCopies::~dlTransformCopies() {
+  QMapIterator <cmsHTRANSFORM,cmsHTRANSFORM> Copy(Copies);
+  while (Copy.hasNext()) {
+    Copy.next();
+    if (Copy.value() != Copy.key()) cmsDeleteTransform(Copy.value());
+  }
+  if (Context) cmsDeleteContext(Context);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ThreadCopies
+// Those of the calling thread, created on first use.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+dlTransformCopies* dlTransformCache::ThreadCopies() {
+  if (!m_Threads.hasLocalData()) m_Threads.setLocalData(new dlTransformCopies);
+  return m_Threads.localData();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ForThread
+// Only the calling thread uses its copies, so the copy is built outside
+// the lock : threads seeing a transform for the first time build their
+// copies at the same time.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+cmsHTRANSFORM dlTransformCache::ForThread(cmsHTRANSFORM Transform) {
+  if (!Transform) return Transform;
+
+  dlTransformCopies* Mine = ThreadCopies();
+  cmsHTRANSFORM Copy = Mine->Copies.value(Transform,NULL);
+  if (Copy) return Copy;
+
+  dlTransformRecipe Recipe;
+  {
+    QMutexLocker Locker(&m_Mutex);
+    // Not from the cache, nothing to copy from.
+    if (!m_Recipes.contains(Transform)) return Transform;
+    Recipe = m_Recipes[Transform];
+  }
+
+  if (Mine->Context) Copy = Build(Mine->Context,Recipe);
+  // Sharing the original is the fallback, it always worked.
+  if (!Copy) Copy = Transform;
+  Mine->Copies.insert(Transform,Copy);
+  return Copy;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ChunkPixels
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static long L2Size() {
+  long Size = 0;
+#if defined(__linux__) && defined(_SC_LEVEL2_CACHE_SIZE)
+  Size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+  return (Size > 0) ? Size : dlTransformCache_L2Size;
+}
+
+int32_t dlTransformCache::ChunkPixels(const int64_t NrPixels) {
+  // Half the L2, the rest is for the tables of the transform.
+  static const int32_t CachePixels =
+    MAX(dlTransformCache_MinChunk,L2Size()/2/(int32_t)sizeof(uint16_t[3]));
+#ifdef _OPENMP
+  const int32_t NrThreads = omp_get_max_threads();
+#else
+  const int32_t NrThreads = 1;
+#endif
+  const int64_t NrChunks = (int64_t)dlTransformCache_ChunksPerThread*NrThreads;
+  const int64_t Balanced = (NrPixels+NrChunks-1)/NrChunks;
+  return (int32_t) MAX((int64_t)dlTransformCache_MinChunk,
+                       MIN((int64_t)CachePixels,Balanced));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Run, RunLines
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlTransformCache::Run(cmsHTRANSFORM  Transform,
+                           uint16_t       (*Input)[3],
+                           uint16_t       (*Output)[3],
+                           const int64_t  NrPixels) {
+  const int32_t Chunk = ChunkPixels(NrPixels);
+#pragma omp parallel default(shared)
+  {
+    // Only threads that get a chunk need a copy.
+    cmsHTRANSFORM Mine = NULL;
+#pragma omp for schedule(dynamic)
+    for (int64_t i = 0; i < NrPixels; i+=Chunk) {
+      if (!Mine) {
+        Mine = ForThread(Transform);
+      }
+      const int32_t Length = (int32_t) MIN((int64_t)Chunk,NrPixels-i);
+      cmsDoTransform(Mine,Input[i],Output[i],Length);
+    }
+  }
+}
+
+void dlTransformCache::RunLines(cmsHTRANSFORM  Transform,
+                                const void*    Input,
+                                void*          Output,
+                                const uint32_t Width,
+                                const uint32_t Lines,
+                                const uint32_t InLineStride,
+                                const uint32_t OutLineStride,
+                                const uint32_t InPlaneStride,
+                                const uint32_t OutPlaneStride) {
+  Transform = ForThread(Transform);
+  cmsDoTransformLineStride(Transform,Input,Output,Width,Lines,
+                           InLineStride,OutLineStride,
+                           InPlaneStride,OutPlaneStride);
+}
+
+////////////////////////////////////////////////////////////////////////////////
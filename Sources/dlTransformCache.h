@@ -0,0 +1,167 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// LabCurves
+//
+// Copyright (C) 2009,2010 Michael Munzert <mail@mm-log.com>
+//
+// This file is part of LabCurves.
+//
+// LabCurves is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3 of the License.
+//
+// LabCurves is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with LabCurves.  If not, see <http://www.gnu.org/licenses/>.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DLTRANSFORMCACHE_H
+#define DLTRANSFORMCACHE_H
+
+#include <QtCore>
+
+#include <lcms2.h>
+
+#include "dlDefines.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// dlTransformCache
+// Process wide cache of lcms transforms, so preview refreshes, opening
+// and export (and every image of a batch) build a transform only once.
+//
+// A profile is given as ICC buffer. Without buffer (or if it does not
+// open) it is the built in Lab (v4) for a Lab pixel format and sRGB
+// otherwise. The key is the MD5 of the profiles, the pixel formats,
+// the intent and the flags.
+//
+// The transforms are owned by the cache and live until the process
+// ends : callers must not delete them. Sharing one between threads is
+// fine, the code did that per image already.
+//
+// Once a directory is set, each transform built from profiles only is
+// also saved there as device link, and the next run (or another process)
+// loads that instead of building from the profiles again. Transforms with
+// a Lab profile in between are not : for the Lab curves that would be a
+// file per curve edit, never used again and never removed.
+//
+// Run spreads a conversion over the threads in chunks that fit the L2
+// cache. Every thread but the one that built the transform gets its own
+// copy in its own lcms context, built the same way as the original so
+// the results do not depend on the thread. The copies are kept per OS
+// thread (not per OpenMP thread number, which concurrent teams share)
+// and deleted when their thread ends.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// How a transform was built, to build the copies per thread.
+struct dlTransformRecipe {
+  // ICC buffers, empty for the built in one of the format.
+  QByteArray      Profiles[3];
+  cmsUInt32Number ProfileFormats[3];
+  short           NrProfiles;
+  // When loaded from disk, the device link instead of the profiles.
+  QByteArray      DeviceLink;
+  cmsUInt32Number InFormat;
+  cmsUInt32Number OutFormat;
+  cmsUInt32Number Intent;
+  cmsUInt32Number Flags;
+};
+
+// The copies of one thread, by original, and their lcms context.
+struct dlTransformCopies {
+  cmsContext                          Context;
+  QMap <cmsHTRANSFORM,cmsHTRANSFORM>  Copies;
+  dlTransformCopies();
+  ~dlTransformCopies();
+};
+
+class dlTransformCache {
+public:
+
+static cmsHTRANSFORM Get(const uint8_t*        InProfileBuffer,
+                         const long            InProfileSize,
+                         const cmsUInt32Number InFormat,
+                         const uint8_t*        OutProfileBuffer,
+                         const long            OutProfileSize,
+                         const cmsUInt32Number OutFormat,
+                         const cmsUInt32Number Intent,
+                         const cmsUInt32Number Flags);
+
+// As above with a Lab to Lab profile (abstract or device link) in
+// between, for instance the Lab curves.
+static cmsHTRANSFORM Get(const uint8_t*        InProfileBuffer,
+                         const long            InProfileSize,
+                         const cmsUInt32Number InFormat,
+                         const uint8_t*        LabProfileBuffer,
+                         const long            LabProfileSize,
+                         const uint8_t*        OutProfileBuffer,
+                         const long            OutProfileSize,
+                         const cmsUInt32Number OutFormat,
+                         const cmsUInt32Number Intent,
+                         const cmsUInt32Number Flags);
+
+// In parallel, NrPixels 16 bit 3 channel pixels from Input to Output
+// (which may be the same).
+static void Run(cmsHTRANSFORM  Transform,
+                uint16_t       (*Input)[3],
+                uint16_t       (*Output)[3],
+                const int64_t  NrPixels);
+
+// On the calling thread, Lines lines of Width pixels the given strides
+// (in bytes) apart. The plane strides are for planar formats.
+static void RunLines(cmsHTRANSFORM  Transform,
+                     const void*    Input,
+                     void*          Output,
+                     const uint32_t Width,
+                     const uint32_t Lines,
+                     const uint32_t InLineStride,
+                     const uint32_t OutLineStride,
+                     const uint32_t InPlaneStride  = 0,
+                     const uint32_t OutPlaneStride = 0);
+
+// Pixels per chunk when NrPixels 16 bit 3 channel pixels are split over
+// the threads : what fits half the L2 cache, less if needed to give
+// each thread a few chunks.
+static int32_t ChunkPixels(const int64_t NrPixels);
+
+// The copy of Transform for the calling thread, Transform itself for
+// the thread that built it.
+static cmsHTRANSFORM ForThread(cmsHTRANSFORM Transform);
+
+// Directory of the device links. Empty (the default) for none.
+static void SetDirectory(const QString Directory);
+
+// The one shared by the gui and labcurves-cli.
+static QString DefaultDirectory();
+
+private:
+static QByteArray  ProfileKey(const uint8_t*        ProfileBuffer,
+                              const long            ProfileSize,
+                              const cmsUInt32Number Format);
+static cmsHPROFILE OpenProfile(cmsContext            Context,
+                               const QByteArray      Profile,
+                               const cmsUInt32Number Format);
+static cmsHTRANSFORM Build(cmsContext               Context,
+                           const dlTransformRecipe& Recipe);
+static QString     DeviceLinkFileName(const QByteArray Key);
+static QByteArray  LoadDeviceLink(const QByteArray Key);
+static void        SaveDeviceLink(const QByteArray Key,
+                                  cmsHTRANSFORM    Transform);
+static dlTransformCopies* ThreadCopies();
+
+static QMutex                                    m_Mutex;
+static QMap <QByteArray,cmsHTRANSFORM>           m_Transforms;
+static QMap <cmsHTRANSFORM,dlTransformRecipe>    m_Recipes;
+static QThreadStorage <dlTransformCopies*>       m_Threads;
+static QString                                   m_Directory;
+};
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
@@ -23,6 +23,9 @@
 
 #include "dlViewWindow.h"
 #include "dlSettings.h"
+#include "dlResize.h"
+
+#include <cstring>
 
 #include <QPen>
 #include <QMessageBox>
@@ -31,6 +34,7 @@
 void UpdateSettings();
 void CB_InputChanged(const QString,const QVariant);
 void CB_ZoomFitButton();
+void CB_ViewWindowRegionChanged();
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -39,7 +43,7 @@ void CB_ZoomFitButton();
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-dlViewWindow::dlViewWindow(const dlImage* RelatedImage,
+dlViewWindow::dlViewWindow(const QImage*  RelatedImage,
                                  QWidget* Parent)
 
   : QAbstractScrollArea(Parent) {
@@ -50,8 +54,13 @@ dlViewWindow::dlViewWindow(const dlImage* RelatedImage,
 
   // Some other dynamic members we want to have clean.
   m_QImage           = NULL;
-  m_QImageZoomed     = NULL;
   m_QImageCut        = NULL;
+  m_QImageDetail       = NULL;
+  m_QImageDetailZoomed = NULL;
+  m_DetailX          = 0;
+  m_DetailY          = 0;
+  m_DetailWidth      = 0;
+  m_DetailHeight     = 0;
   // With respect to event handling.
   m_StartDragX       = 0;
   m_StartDragY       = 0;
@@ -124,6 +133,14 @@ dlViewWindow::dlViewWindow(const dlImage* RelatedImage,
   // for resize with mousewheel
   m_NewSize = 0;
 
+  // A timer for reporting the shown region, once scrolling rests.
+  m_RegionTimeOut = 200;
+  m_RegionTimer = new QTimer(this);
+  m_RegionTimer->setSingleShot(1);
+
+  connect(m_RegionTimer,SIGNAL(timeout()),
+          this,SLOT(RegionTimerExpired()));
+
   // Create actions for context menu
   m_AtnZoomFit = new QAction(QObject::tr("Zoom fit"), this);
   connect(m_AtnZoomFit, SIGNAL(triggered()), this, SLOT(MenuZoomFit()));
@@ -152,8 +169,9 @@ dlViewWindow::dlViewWindow(const dlImage* RelatedImage,
 dlViewWindow::~dlViewWindow() {
   //printf("(%s,%d) %s\n",__FILE__,__LINE__,__PRETTY_FUNCTION__);
   delete m_QImage;
-  delete m_QImageZoomed;
   delete m_QImageCut;
+  delete m_QImageDetail;
+  delete m_QImageDetailZoomed;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -177,31 +195,31 @@ short dlViewWindow::SelectionOngoing() {
   return m_SelectionOngoing;
 }
 
-uint16_t dlViewWindow::GetSelectionX() {
-  uint16_t X = MIN(m_StartDragX,m_EndDragX);
+uint32_t dlViewWindow::GetSelectionX() {
+  uint32_t X = MIN(m_StartDragX,m_EndDragX);
   X -= m_XOffsetInVP;
   X += m_StartX;
-  X = (uint16_t)(X/m_ZoomFactor+0.5);
+  X = (uint32_t)(X/m_ZoomFactor+0.5);
   return X;
 }
 
-uint16_t dlViewWindow::GetSelectionY() {
-  uint16_t Y = MIN(m_StartDragY,m_EndDragY);
+uint32_t dlViewWindow::GetSelectionY() {
+  uint32_t Y = MIN(m_StartDragY,m_EndDragY);
   Y -= m_YOffsetInVP;
   Y += m_StartY;
-  Y = (uint16_t)(Y/m_ZoomFactor+0.5);
+  Y = (uint32_t)(Y/m_ZoomFactor+0.5);
   return Y;
 }
 
-uint16_t dlViewWindow::GetSelectionWidth() {
-  uint16_t W = abs(m_StartDragX-m_EndDragX);
-  W = (uint16_t)(W/m_ZoomFactor+0.5);
+uint32_t dlViewWindow::GetSelectionWidth() {
+  uint32_t W = abs(m_StartDragX-m_EndDragX);
+  W = (uint32_t)(W/m_ZoomFactor+0.5);
   return W;
 }
 
-uint16_t dlViewWindow::GetSelectionHeight() {
-  uint16_t H = abs(m_StartDragY-m_EndDragY);
-  H = (uint16_t)(H/m_ZoomFactor+0.5);
+uint32_t dlViewWindow::GetSelectionHeight() {
+  uint32_t H = abs(m_StartDragY-m_EndDragY);
+  H = (uint32_t)(H/m_ZoomFactor+0.5);
   return H;
 }
 
@@ -240,9 +258,9 @@ short dlViewWindow::ZoomFit() {
   }
   // Normal condition.
   double Factor1 =(double)
-    (viewport()->size().width())/m_RelatedImage->m_Width;
+    (viewport()->size().width())/m_RelatedImage->width();
   double Factor2 =(double)
-    (viewport()->size().height())/m_RelatedImage->m_Height;
+    (viewport()->size().height())/m_RelatedImage->height();
   m_ZoomFactor = MIN(Factor1,Factor2);
   UpdateView();
   return (short)(m_ZoomFactor*100+0.5);
@@ -259,7 +277,8 @@ void dlViewWindow::Zoom(const short Factor) {
 //
 ////////////////////////////////////////////////////////////////////////////////
 
-void dlViewWindow::UpdateView(const dlImage* NewRelatedImage, const short StartUp) {
+void dlViewWindow::UpdateView(const QImage* NewRelatedImage,
+                              const short   StartUp) {
 
   if (StartUp == 0) {
     if (NewRelatedImage) m_RelatedImage = NewRelatedImage;
@@ -267,43 +286,32 @@ void dlViewWindow::UpdateView(const dlImage* NewRelatedImage, const short StartU
 
     if (Settings->GetInt("ZoomMode")==dlZoomMode_Fit) {
       double Factor1 =(double)
-        (viewport()->size().width())/m_RelatedImage->m_Width;
+        (viewport()->size().width())/m_RelatedImage->width();
       double Factor2 =(double)
-        (viewport()->size().height())/m_RelatedImage->m_Height;
+        (viewport()->size().height())/m_RelatedImage->height();
       m_ZoomFactor = MIN(Factor1,Factor2);
       Settings->SetValue("Zoom",(int)(m_ZoomFactor*100+0.5));
     }
 
-    // Convert the dlImage to a QImage. Mind R<->B and 16->8
+    // Shares the pixels of the preview.
     if (NewRelatedImage) {
       delete m_QImage;
-      m_QImage = new QImage(m_RelatedImage->m_Width,
-                            m_RelatedImage->m_Height,
-                            QImage::Format_RGB32);
-      for (uint16_t Row=0; Row<m_RelatedImage->m_Height; Row++) {
-        for (uint16_t Col=0; Col<m_RelatedImage->m_Width; Col++) {
-          uint32_t PixelInQFormat;
-          uint8_t* Pixel = (uint8_t*) &PixelInQFormat;
-          for (short c=0; c<3; c++) {
-            // Mind the R<->B swap !
-            Pixel[2-c] =
-              m_RelatedImage->m_Image[Row*m_RelatedImage->m_Width+Col][c]>>8;
-          }
-          Pixel[3] = 0xff;
-          m_QImage->setPixel(Col,Row,PixelInQFormat);
-        }
-      }
+      m_QImage = new QImage(*m_RelatedImage);
+      m_Tiles.clear();
     }
     // Size of zoomed image.
-    m_ZoomWidth  = (uint16_t)(m_RelatedImage->m_Width*m_ZoomFactor+.5);
-    m_ZoomHeight = (uint16_t)(m_RelatedImage->m_Height*m_ZoomFactor+.5);
+    m_ZoomWidth  = (uint32_t)(m_RelatedImage->width()*m_ZoomFactor+.5);
+    m_ZoomHeight = (uint32_t)(m_RelatedImage->height()*m_ZoomFactor+.5);
 
   } else {
     delete m_QImage;
-    m_QImage = new QImage(":/LabCurves/Splash.png");
+    // Tiles are made from 32 bit pixels.
+    m_QImage = new QImage(QImage(":/LabCurves/Splash.png").
+                            convertToFormat(QImage::Format_ARGB32));
+    m_Tiles.clear();
     // Size of zoomed image.
-    m_ZoomWidth  = (uint16_t)(m_QImage->width()*m_ZoomFactor+.5);
-    m_ZoomHeight = (uint16_t)(m_QImage->height()*m_ZoomFactor+.5);
+    m_ZoomWidth  = (uint32_t)(m_QImage->width()*m_ZoomFactor+.5);
+    m_ZoomHeight = (uint32_t)(m_QImage->height()*m_ZoomFactor+.5);
   }
 
 
@@ -336,13 +344,9 @@ void dlViewWindow::UpdateView(const dlImage* NewRelatedImage, const short StartU
 
     m_PreviousZoomFactor = m_ZoomFactor;
 
-    // Recalculate the zoomed image.
-    delete m_QImageZoomed;
-    m_QImageZoomed = new QImage(m_QImage->scaled(m_ZoomWidth,
-                                                 m_ZoomHeight,
-                                                 Qt::IgnoreAspectRatio,
-                                                 Qt::SmoothTransformation));
-
+    // The zoomed image is made again, as far as shown.
+    m_Tiles.clear();
+    RecalculateDetail();
   }
 
   // Maybe move scrollbars such that centrum stays centrum during zoom.
@@ -357,12 +361,65 @@ void dlViewWindow::UpdateView(const dlImage* NewRelatedImage, const short StartU
   verticalScrollBar()->setValue(CurrentStartY);
   verticalScrollBar()->blockSignals(0);
 
-  // Recalculate the image cut out of m_QImageZoomed.
+  // Recalculate the image cut out of the zoomed image.
   RecalculateCut();
 
   // Update view.
   viewport()->update();
 
+  if (StartUp == 0) m_RegionTimer->start(m_RegionTimeOut);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Region and detail
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void dlViewWindow::GetVisibleRegion(double& X,
+                                    double& Y,
+                                    double& Width,
+                                    double& Height) {
+  X = Y = Width = Height = 0;
+  if (!m_RelatedImage || !m_QImageCut) return;
+  X      = m_StartX/m_ZoomFactor;
+  Y      = m_StartY/m_ZoomFactor;
+  Width  = m_QImageCut->width()/m_ZoomFactor;
+  Height = m_QImageCut->height()/m_ZoomFactor;
+}
+
+void dlViewWindow::UpdateDetail(const QImage*  Detail,
+                                const double   X,
+                                const double   Y,
+                                const double   Width,
+                                const double   Height) {
+  delete m_QImageDetail;
+  m_QImageDetail = NULL;
+  if (Detail) {
+    m_QImageDetail = new QImage(*Detail);
+    m_DetailX      = X;
+    m_DetailY      = Y;
+    m_DetailWidth  = Width;
+    m_DetailHeight = Height;
+  }
+  RecalculateDetail();
+  viewport()->update();
+}
+
+// The detail scaled to the zoom, so painting is only a copy.
+void dlViewWindow::RecalculateDetail() {
+  delete m_QImageDetailZoomed;
+  m_QImageDetailZoomed = NULL;
+  if (!m_QImageDetail) return;
+  m_QImageDetailZoomed =
+    new QImage(m_QImageDetail->scaled((int)(m_DetailWidth*m_ZoomFactor+.5),
+                                      (int)(m_DetailHeight*m_ZoomFactor+.5),
+                                      Qt::IgnoreAspectRatio,
+                                      Qt::SmoothTransformation));
+}
+
+void dlViewWindow::RegionTimerExpired() {
+  ::CB_ViewWindowRegionChanged();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -371,27 +428,94 @@ void dlViewWindow::UpdateView(const dlImage* NewRelatedImage, const short StartU
 //
 // Recalculates m_QImageCut when the selection
 // has been changed, i.e. for scrollbar movements or a resizing.
+// It is put together from the tiles of the zoomed image, those not
+// made yet are made now and those away from the view dropped.
 //
 ////////////////////////////////////////////////////////////////////////////////
 
 void dlViewWindow::RecalculateCut() {
 
-  if (!m_QImageZoomed) return;
+  if (!m_QImage || !m_ZoomWidth || !m_ZoomHeight) return;
 
   // Following are coordinates in a zoomed image.
-  m_StartX = horizontalScrollBar()->value();
-  uint16_t Width  = MIN(horizontalScrollBar()->pageStep(),
-                        m_QImageZoomed->width());
-  m_StartY = verticalScrollBar()->value();
-  uint16_t Height = MIN(verticalScrollBar()->pageStep(),
-                        m_QImageZoomed->height());
-
-  // Make a new cut out of our zoomed image
+  m_StartX = MIN((uint32_t)horizontalScrollBar()->value(),m_ZoomWidth-1);
+  uint32_t Width  = MIN((uint32_t)horizontalScrollBar()->pageStep(),
+                        m_ZoomWidth-m_StartX);
+  m_StartY = MIN((uint32_t)verticalScrollBar()->value(),m_ZoomHeight-1);
+  uint32_t Height = MIN((uint32_t)verticalScrollBar()->pageStep(),
+                        m_ZoomHeight-m_StartY);
+  if (!Width || !Height) return;
+
+  const uint32_t Size   = dlViewWindow_TileSize;
+  const uint32_t TileX0 = m_StartX/Size;
+  const uint32_t TileX1 = (m_StartX+Width-1)/Size;
+  const uint32_t TileY0 = m_StartY/Size;
+  const uint32_t TileY1 = (m_StartY+Height-1)/Size;
+
+  // One ring of tiles around the view is kept.
+  QMap<uint32_t,QImage>::iterator Tile = m_Tiles.begin();
+  while (Tile != m_Tiles.end()) {
+    const uint32_t TileX = Tile.key() & 0xffff;
+    const uint32_t TileY = Tile.key() >> 16;
+    if (TileX+1 < TileX0 || TileX > TileX1+1 ||
+        TileY+1 < TileY0 || TileY > TileY1+1) {
+      Tile = m_Tiles.erase(Tile);
+    } else {
+      ++Tile;
+    }
+  }
+
+  // Make a new cut out of the tiles.
   delete m_QImageCut;
-  m_QImageCut = new QImage(m_QImageZoomed->copy(m_StartX,
-                                                m_StartY,
-                                                Width,
-                                                Height));
+  m_QImageCut = new QImage(Width,Height,m_QImage->format());
+  for (uint32_t TileY=TileY0; TileY<=TileY1; TileY++) {
+    for (uint32_t TileX=TileX0; TileX<=TileX1; TileX++) {
+      const QImage& Zoomed = ZoomedTile(TileX,TileY);
+      // The part of the tile within the cut.
+      const uint32_t X0 = MAX(TileX*Size,m_StartX);
+      const uint32_t X1 = MIN((TileX+1)*Size,m_StartX+Width);
+      const uint32_t Y0 = MAX(TileY*Size,m_StartY);
+      const uint32_t Y1 = MIN((TileY+1)*Size,m_StartY+Height);
+      for (uint32_t Y=Y0; Y<Y1; Y++) {
+        memcpy(m_QImageCut->scanLine(Y-m_StartY)+4*(X0-m_StartX),
+               Zoomed.scanLine(Y-TileY*Size)+4*(X0-TileX*Size),
+               4*(X1-X0));
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ZoomedTile()
+//
+// Tile TileX,TileY of the image at m_ZoomFactor, resampled from m_QImage
+// the first time it is asked for.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+const QImage& dlViewWindow::ZoomedTile(const uint32_t TileX,
+                                       const uint32_t TileY) {
+
+  const uint32_t Key = TileY<<16 | TileX;
+  QMap<uint32_t,QImage>::iterator Found = m_Tiles.find(Key);
+  if (Found != m_Tiles.end()) return Found.value();
+
+  const uint32_t Size   = dlViewWindow_TileSize;
+  const uint32_t X      = TileX*Size;
+  const uint32_t Y      = TileY*Size;
+  const uint32_t Width  = MIN(Size,m_ZoomWidth-X);
+  const uint32_t Height = MIN(Size,m_ZoomHeight-Y);
+
+  // Read only, the pixels may be shared with the pipe's.
+  const QImage* Source = m_QImage;
+  QImage Zoomed(Width,Height,Source->format());
+  dlResize(Source->bits(),Source->width(),Source->height(),
+           Source->bytesPerLine(),m_ZoomFactor,
+           X,Y,Width,Height,
+           Zoomed.bits(),Zoomed.bytesPerLine());
+
+  return m_Tiles.insert(Key,Zoomed).value();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -408,6 +532,7 @@ void dlViewWindow::scrollContentsBy(int,int) {
   RecalculateCut();
   // And update the view.
   viewport()->repaint();
+  m_RegionTimer->start(m_RegionTimeOut);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -448,6 +573,17 @@ bool dlViewWindow::viewportEvent(QEvent* Event) {
     Painter.fillRect(0,0,VP_Width,VP_Height,palette().color(QPalette::Window));
     if (m_QImageCut) {
       Painter.drawImage(m_XOffsetInVP,m_YOffsetInVP,*m_QImageCut);
+      // The detail over it, within the image.
+      if (m_QImageDetailZoomed) {
+        Painter.save();
+        Painter.setClipRect(m_XOffsetInVP,m_YOffsetInVP,
+                            m_QImageCut->width(),m_QImageCut->height());
+        Painter.drawImage(
+          (int)(m_DetailX*m_ZoomFactor+.5)-(int)m_StartX+m_XOffsetInVP,
+          (int)(m_DetailY*m_ZoomFactor+.5)-(int)m_StartY+m_YOffsetInVP,
+          *m_QImageDetailZoomed);
+        Painter.restore();
+      }
     }
     if (m_DrawRectangle) {
       int16_t FrameX0 = m_XOffsetInVP;
@@ -503,6 +639,7 @@ bool dlViewWindow::viewportEvent(QEvent* Event) {
 
     // Recalculat the cut.
     RecalculateCut();
+    m_RegionTimer->start(m_RegionTimeOut);
     if (Settings->GetInt("ZoomMode") == dlZoomMode_Fit)
       ::CB_ZoomFitButton();
 
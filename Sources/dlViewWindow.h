@@ -28,6 +28,8 @@
 
 #include "dlImage.h"
 
+// Size of the tiles the zoomed image is made in.
+const uint32_t dlViewWindow_TileSize = 256;
 
 class dlViewWindow : public QAbstractScrollArea {
 
@@ -36,14 +38,15 @@ Q_OBJECT
 public :
 
 // Constructor.
-dlViewWindow(const dlImage*       RelatedImage,
+dlViewWindow(const QImage*        RelatedImage,
                    QWidget*       Parent);
 // Destructor.
 ~dlViewWindow();
 
-// NewRelatedImage to associate anonter dlImage with this window.
-void UpdateView(const dlImage* NewRelatedImage = NULL,
-                const short StartUp = 0);
+// NewRelatedImage to associate another image with this window (the
+// preview, already converted to the screen : shared, not copied).
+void UpdateView(const QImage* NewRelatedImage = NULL,
+                const short   StartUp = 0);
 
 
 // Allow to select in the image. (push/drag/release events).
@@ -58,10 +61,10 @@ short SelectionOngoing();
 
 // Results of selection.
 // Expressed in terms of the RelatedImage.
-uint16_t GetSelectionX();
-uint16_t GetSelectionY();
-uint16_t GetSelectionWidth();
-uint16_t GetSelectionHeight();
+uint32_t GetSelectionX();
+uint32_t GetSelectionY();
+uint32_t GetSelectionWidth();
+uint32_t GetSelectionHeight();
 
 // Grid
 void Grid(const short Enabled, const short GridX, const short GridY);
@@ -70,10 +73,24 @@ void Grid(const short Enabled, const short GridX, const short GridY);
 short ZoomFit();
 void  Zoom(const short Factor); // Expressed in %
 
+// The part of the image shown, in its pixels.
+void GetVisibleRegion(double& X, double& Y, double& Width, double& Height);
+
+// Detail is shown over the image at X,Y Width x Height (in pixels of the
+// image, so Detail may have more of them), for zooms beyond the image.
+// NULL removes it. Made again when the zoom changes, but moving or
+// zooming itself is reported to CB_ViewWindowRegionChanged, a bit
+// later to skip the steps in between.
+void UpdateDetail(const QImage*  Detail,
+                  const double   X      = 0,
+                  const double   Y      = 0,
+                  const double   Width  = 0,
+                  const double   Height = 0);
+
 // Status report
 void StatusReport (short State);
 
-const dlImage*       m_RelatedImage;
+const QImage*        m_RelatedImage;
 
 short                m_SelectionAllowed;
 short                m_SelectionOngoing;
@@ -83,17 +100,23 @@ int16_t              m_EndDragX;
 int16_t              m_EndDragY;
 short                m_FixedAspectRatio;
 double               m_HOverW;
-uint16_t             m_StartX; // Offset of the shown part into the image.
-uint16_t             m_StartY;
+uint32_t             m_StartX; // Offset of the shown part into the image.
+uint32_t             m_StartY;
 uint16_t             m_XOffsetInVP; // For images smaller than viewport
 uint16_t             m_YOffsetInVP;
 double               m_ZoomFactor;
 
 // Order reflects also order into the pipe :
-// The original->Zoom->Cut (to visible) ->pixmap for acceleration.
+// The original->Zoom (tiles, only those shown)->Cut (to visible).
 QImage*              m_QImage;
-QImage*              m_QImageZoomed;
 QImage*              m_QImageCut;
+// The detail, at its own and at the zoomed size.
+QImage*              m_QImageDetail;
+QImage*              m_QImageDetailZoomed;
+double               m_DetailX;
+double               m_DetailY;
+double               m_DetailWidth;
+double               m_DetailHeight;
 
 protected:
 // overloaded virtual ones.
@@ -106,13 +129,19 @@ void MenuZoom100();
 void SizeReportTimerExpired();
 void StatusReportTimerExpired();
 void ResizeTimerExpired();
+void RegionTimerExpired();
 
 private:
 void        RecalculateCut();
+void        RecalculateDetail();
+const QImage& ZoomedTile(const uint32_t TileX, const uint32_t TileY);
 void        ContextMenu(QEvent* Event);
 
-uint16_t    m_ZoomWidth;
-uint16_t    m_ZoomHeight;
+uint32_t    m_ZoomWidth;
+uint32_t    m_ZoomHeight;
+// Tiles of the zoomed image made so far, key TileY<<16|TileX. Kept
+// while they are in or next to the view, for scrolling.
+QMap<uint32_t,QImage> m_Tiles;
 double      m_PreviousZoomFactor;
 short       m_Grid;
 short       m_GridX;
@@ -132,6 +161,8 @@ QTimer*     m_StatusReportTimer;
 int         m_ResizeTimeOut;
 QTimer*     m_ResizeTimer;
 int         m_NewSize;
+int         m_RegionTimeOut;
+QTimer*     m_RegionTimer;
 
 public:
 };